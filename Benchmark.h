@@ -0,0 +1,168 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "VOLParser.h"
+
+const size_t BENCHMARK_SYNTHETIC_BYTES = size_t(2) << 30; // 2 GiB
+
+double elapsedMilliseconds(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/// <summary>
+/// Writes a VOL file of the given resolution filled with a repeating ramp, streaming it out in slices.
+/// </summary>
+/// <param name="VOL_filepath">Where the file is written.</param>
+/// <param name="resolution">The resolution of the volume (x changes the fastest).</param>
+/// <returns>Whether the file was written completely.</returns>
+bool writeSyntheticVOLFile(const char* VOL_filepath, glm::ivec3 resolution) {
+	std::ofstream VOL_fstream(VOL_filepath, std::ios::binary);
+	if (!VOL_fstream)
+		return false;
+
+	auto put_int = [&](int value) {
+		unsigned char bytes[] = { (unsigned char)(value >> 24), (unsigned char)(value >> 16), (unsigned char)(value >> 8), (unsigned char)value };
+		VOL_fstream.write((const char*)bytes, 4);
+	};
+	auto put_float = [&](float value) {
+		int binary;
+		std::memcpy(&binary, &value, sizeof(float));
+		put_int(binary);
+	};
+
+	put_int(resolution.z);
+	put_int(resolution.y);
+	put_int(resolution.x);
+	put_int(0);
+	put_float(1.0f);
+	put_float(1.0f);
+	put_float(1.0f);
+
+	std::vector<unsigned char> slice((size_t)resolution.x * resolution.y);
+	for (int z = 0; z < resolution.z && VOL_fstream; ++z) {
+		for (size_t i = 0; i < slice.size(); ++i)
+			slice[i] = (unsigned char)(i + z);
+		VOL_fstream.write((const char*)slice.data(), slice.size());
+	}
+	return (bool)VOL_fstream;
+}
+
+/// <summary>
+/// A mostly empty volume with a few solid balls, whose values fall off towards their surface.
+/// </summary>
+VOLData makeSparseSyntheticVolume(glm::ivec3 resolution, int ball_count = 6) {
+	VOLData data;
+	data.name = "Sparse Synthetic";
+	data.resolution = resolution;
+	data.saved_border = 0;
+	data.true_size = glm::vec3(1.0f);
+	data.voxel_type = VoxelType::UInt8;
+	std::vector<unsigned char> values(voxelCount(data), 0);
+	float radius = std::min(resolution.x, std::min(resolution.y, resolution.z)) / 12.0f;
+	for (int ball = 0; ball < ball_count; ++ball) {
+		// spread along a diagonal so the balls do not overlap
+		glm::vec3 center = glm::vec3(resolution) * (0.15f + 0.7f * ball / std::max(1, ball_count - 1));
+		center.y = resolution.y * (ball % 2 == 0 ? 0.3f : 0.7f);
+		for (int z = 0; z < resolution.z; ++z) {
+			for (int y = 0; y < resolution.y; ++y) {
+				for (int x = 0; x < resolution.x; ++x) {
+					float distance = glm::length(glm::vec3(x, y, z) - center);
+					if (distance < radius)
+						values[((size_t)z * resolution.y + y) * resolution.x + x] = (unsigned char)(255.0f * (1.0f - distance / radius));
+				}
+			}
+		}
+	}
+	data.values = std::move(values);
+	return data;
+}
+
+/// <summary>
+/// Reads every voxel once, standing in for the driver copying the voxels during the upload.
+/// </summary>
+unsigned long long touchVOLValues(const VOLData& data) {
+	unsigned long long checksum = 0;
+	for (unsigned char x : data.values)
+		checksum += x;
+	return checksum;
+}
+
+/// <summary>
+/// Compares the time to load and read through a VOL file via the ifstream copy and via the memory mapping.
+/// </summary>
+/// <param name="VOL_filepath">The VOL file to load.</param>
+/// <param name="repetitions">How many times each loader runs, the best time is reported.</param>
+void benchmarkVOLLoading(const char* VOL_filepath, int repetitions = 3) {
+	if (!std::filesystem::exists(VOL_filepath)) {
+		std::cout << "Skipping load benchmark of missing file " << VOL_filepath << std::endl;
+		return;
+	}
+	double bytes = (double)std::filesystem::file_size(VOL_filepath);
+
+	auto run = [&](const char* loader_name, VOLData(*loader)(const char*)) {
+		double best = std::numeric_limits<double>::max();
+		unsigned long long checksum = 0;
+		for (int i = 0; i < repetitions; ++i) {
+			auto start = std::chrono::steady_clock::now();
+			VOLData data = loader(VOL_filepath);
+			checksum = touchVOLValues(data);
+			best = std::min(best, elapsedMilliseconds(start));
+		}
+		std::cout << "  " << loader_name << ": " << best << " ms, " << bytes / (best * 1e6) << " GB/s (checksum " << checksum << ")" << std::endl;
+	};
+
+	std::cout << "----- Load Benchmark: " << VOL_filepath << " (" << bytes / (1 << 20) << " MiB) -----" << std::endl;
+	run("ifstream copy", parseVOLDataFromFile);
+	run("memory mapped", parseVOLDataFromMappedFile);
+}
+
+/// <summary>
+/// Compares converting big endian 16 and 32 bit voxels to native byte order against a plain memcpy of the same bytes.
+/// </summary>
+void benchmarkByteSwapping(size_t bytes, int repetitions = 3) {
+	std::vector<unsigned char> source(bytes), destination(bytes);
+	for (size_t i = 0; i < bytes; ++i)
+		source[i] = (unsigned char)(i * 31);
+
+	auto run = [&](const char* name, const std::function<void()>& convert) {
+		double best = std::numeric_limits<double>::max();
+		for (int i = 0; i < repetitions; ++i) {
+			auto start = std::chrono::steady_clock::now();
+			convert();
+			best = std::min(best, elapsedMilliseconds(start));
+		}
+		std::cout << "  " << name << ": " << best << " ms, " << bytes / (best * 1e6) << " GB/s" << std::endl;
+	};
+
+	std::cout << "----- Byte Swap Benchmark (" << bytes / (1 << 20) << " MiB) -----" << std::endl;
+	run("memcpy", [&]() { std::memcpy(destination.data(), source.data(), bytes); });
+	run("parallel memcpy", [&]() { bigEndianToNative(source.data(), destination.data(), bytes, 1); });
+	run("16 bit swap", [&]() { bigEndianToNative(source.data(), destination.data(), bytes / 2, 2); });
+	run("32 bit swap", [&]() { bigEndianToNative(source.data(), destination.data(), bytes / 4, 4); });
+}
+
+void runLoadingBenchmarks(std::vector<const char*>& VOL_filepaths) {
+	for (const char* VOL_filepath : VOL_filepaths)
+		benchmarkVOLLoading(VOL_filepath);
+
+	// a cubic volume of roughly BENCHMARK_SYNTHETIC_BYTES
+	int side = (int)std::cbrt((double)BENCHMARK_SYNTHETIC_BYTES);
+	std::string synthetic_path = (std::filesystem::temp_directory_path() / "SyntheticBenchmark.vol").string();
+	if (writeSyntheticVOLFile(synthetic_path.c_str(), glm::ivec3(side)))
+		benchmarkVOLLoading(synthetic_path.c_str());
+	else
+		std::cerr << "[ERROR] Could not write the synthetic benchmark volume." << std::endl;
+	std::filesystem::remove(synthetic_path);
+
+	benchmarkByteSwapping((size_t)1 << 30);
+}
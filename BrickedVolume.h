@@ -0,0 +1,179 @@
+#pragma once
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "Parallel.h"
+#include "VOLParser.h"
+
+// interior voxels per side of a brick, each brick is stored with a ghost voxel on every side for trilinear filtering
+const int BRICK_SIZE = 32;
+const int BRICK_GHOST = 1;
+const int BRICK_STORED_SIZE = BRICK_SIZE + 2 * BRICK_GHOST;
+// a volume is only bricked if its brick pool and page table take at most this fraction of the dense texture
+const double BRICKED_MAX_FRACTION = 0.75;
+
+/// <summary>
+/// Where the bricks of a sparse volume are: the page table has an entry per brick of the volume, either the slot of the
+/// brick in the pool or a mark that it is empty. Empty bricks hold nothing but the background value, which their samples return.
+/// </summary>
+struct BrickLayout {
+	bool bricked = false;
+	glm::ivec3 resolution = glm::ivec3(0);
+	// bricks per axis of the volume and of the pool
+	glm::ivec3 page_count = glm::ivec3(0);
+	glm::ivec3 pool_bricks = glm::ivec3(0);
+	size_t occupied = 0;
+	VoxelType voxel_type = VoxelType::UInt8;
+	// the value of every voxel of an empty brick, in the units of the voxel type
+	float background = 0.0f;
+
+	glm::ivec3 poolResolution() const {
+		return pool_bricks * BRICK_STORED_SIZE;
+	}
+
+	size_t pageCount() const {
+		return (size_t)page_count.x * page_count.y * page_count.z;
+	}
+
+	size_t poolBytes() const {
+		glm::ivec3 pool_resolution = poolResolution();
+		return (size_t)pool_resolution.x * pool_resolution.y * pool_resolution.z * voxelSize(voxel_type);
+	}
+
+	glm::ivec3 brickOfPage(size_t page) const {
+		return glm::ivec3((int)(page % page_count.x), (int)(page / page_count.x % page_count.y), (int)(page / ((size_t)page_count.x * page_count.y)));
+	}
+};
+
+/// <summary>
+/// A volume split into bricks with only the non-empty ones kept. page_table holds 4 bytes per brick,
+/// x, y, z of the pool slot and 1 if the brick is occupied, x fastest. The pool is a 3D array of stored bricks.
+/// </summary>
+struct BrickedVolume {
+	BrickLayout layout;
+	std::vector<unsigned char> page_table;
+	VOLValues pool;
+};
+
+/// <summary>
+/// Whether every voxel of a brick and its ghost voxels equals the background.
+/// </summary>
+template <typename T>
+bool brickIsEmpty(const T* values, glm::ivec3 resolution, glm::ivec3 brick, T background) {
+	glm::ivec3 begin = glm::max(brick * BRICK_SIZE - BRICK_GHOST, glm::ivec3(0));
+	glm::ivec3 end = glm::min((brick + 1) * BRICK_SIZE + BRICK_GHOST, resolution);
+	for (int z = begin.z; z < end.z; ++z) {
+		for (int y = begin.y; y < end.y; ++y) {
+			const T* row = values + ((size_t)z * resolution.y + y) * resolution.x;
+			for (int x = begin.x; x < end.x; ++x) {
+				if (row[x] != background)
+					return false;
+			}
+		}
+	}
+	return true;
+}
+
+/// <summary>
+/// Copies a brick with its ghost voxels into its pool slot, ghost voxels past the border of the volume repeat the border
+/// like a clamped texture does.
+/// </summary>
+template <typename T>
+void copyBrickToPool(const T* values, glm::ivec3 resolution, glm::ivec3 brick, T* pool, glm::ivec3 pool_resolution, glm::ivec3 slot) {
+	glm::ivec3 origin = brick * BRICK_SIZE - BRICK_GHOST;
+	glm::ivec3 pool_origin = slot * BRICK_STORED_SIZE;
+	for (int dz = 0; dz < BRICK_STORED_SIZE; ++dz) {
+		int z = std::clamp(origin.z + dz, 0, resolution.z - 1);
+		for (int dy = 0; dy < BRICK_STORED_SIZE; ++dy) {
+			int y = std::clamp(origin.y + dy, 0, resolution.y - 1);
+			const T* row = values + ((size_t)z * resolution.y + y) * resolution.x;
+			T* out = pool + ((size_t)(pool_origin.z + dz) * pool_resolution.y + pool_origin.y + dy) * pool_resolution.x + pool_origin.x;
+			for (int dx = 0; dx < BRICK_STORED_SIZE; ++dx)
+				out[dx] = row[std::clamp(origin.x + dx, 0, resolution.x - 1)];
+		}
+	}
+}
+
+template <typename T>
+std::shared_ptr<const BrickedVolume> brickTypedVolume(const T* values, const VOLData& data, int max_dimension) {
+	glm::ivec3 resolution = data.resolution;
+	auto bricked = std::make_shared<BrickedVolume>();
+	BrickLayout& layout = bricked->layout;
+	layout.resolution = resolution;
+	layout.page_count = (resolution + BRICK_SIZE - 1) / BRICK_SIZE;
+	layout.voxel_type = data.voxel_type;
+
+	// the volume minimum is the background, e.g. the zeros around a scanned object or the air in a CT scan
+	T background = data.statistics.computed ? (T)data.statistics.min_value : *std::min_element(values, values + voxelCount(data));
+	layout.background = (float)background;
+
+	size_t page_count = layout.pageCount();
+	std::vector<unsigned char> occupied(page_count);
+	parallelFor(0, page_count, [&](size_t begin, size_t end, unsigned int) {
+		for (size_t page = begin; page < end; ++page) {
+			occupied[page] = !brickIsEmpty(values, resolution, layout.brickOfPage(page), background);
+		}
+	});
+	layout.occupied = (size_t)std::count(occupied.begin(), occupied.end(), 1);
+
+	// a pool close to a cube, within the texture size limit
+	int max_bricks = max_dimension > 0 ? max_dimension / BRICK_STORED_SIZE : std::numeric_limits<int>::max();
+	int side = std::max(1, std::min(max_bricks, (int)std::ceil(std::cbrt((double)std::max<size_t>(1, layout.occupied)))));
+	layout.pool_bricks = glm::ivec3(side, side, (int)std::max<size_t>(1, (layout.occupied + (size_t)side * side - 1) / ((size_t)side * side)));
+	if (layout.pool_bricks.z > max_bricks)
+		return nullptr;
+
+	size_t dense_bytes = voxelCount(data) * voxelSize(data.voxel_type);
+	if (layout.poolBytes() + page_count * 4 > dense_bytes * BRICKED_MAX_FRACTION)
+		return nullptr;
+
+	// the occupied bricks fill the pool slots in page order
+	std::vector<size_t> occupied_pages;
+	std::vector<glm::ivec3> slots;
+	bricked->page_table.assign(page_count * 4, 0);
+	for (size_t page = 0; page < page_count; ++page) {
+		if (!occupied[page])
+			continue;
+		size_t slot = slots.size();
+		glm::ivec3 slot_index((int)(slot % side), (int)(slot / side % side), (int)(slot / ((size_t)side * side)));
+		occupied_pages.push_back(page);
+		slots.push_back(slot_index);
+		unsigned char* entry = bricked->page_table.data() + page * 4;
+		entry[0] = (unsigned char)slot_index.x;
+		entry[1] = (unsigned char)slot_index.y;
+		entry[2] = (unsigned char)slot_index.z;
+		entry[3] = 1;
+	}
+
+	glm::ivec3 pool_resolution = layout.poolResolution();
+	std::vector<unsigned char> pool(layout.poolBytes());
+	parallelFor(0, occupied_pages.size(), [&](size_t begin, size_t end, unsigned int) {
+		for (size_t i = begin; i < end; ++i)
+			copyBrickToPool(values, resolution, layout.brickOfPage(occupied_pages[i]), (T*)pool.data(), pool_resolution, slots[i]);
+	});
+	bricked->pool = std::move(pool);
+	layout.bricked = true;
+	return bricked;
+}
+
+/// <summary>
+/// Splits a volume into bricks and keeps the non-empty ones in a pool, if that saves enough memory.
+/// </summary>
+/// <param name="max_dimension">The largest side of a texture, 0 for no limit. The pool slots are addressed with a byte per axis.</param>
+/// <returns>The bricked volume, nullptr if the volume is better kept dense.</returns>
+std::shared_ptr<const BrickedVolume> brickVolume(const VOLData& data, int max_dimension = 0) {
+	if (data.values.size() < voxelCount(data) * voxelSize(data.voxel_type) || voxelCount(data) == 0)
+		return nullptr;
+	max_dimension = std::min(max_dimension > 0 ? max_dimension : 256 * BRICK_STORED_SIZE, 256 * BRICK_STORED_SIZE);
+	switch (data.voxel_type) {
+		case VoxelType::UInt8: return brickTypedVolume(data.values.data(), data, max_dimension);
+		case VoxelType::UInt16: return brickTypedVolume((const unsigned short*)data.values.data(), data, max_dimension);
+		case VoxelType::Float32: return brickTypedVolume((const float*)data.values.data(), data, max_dimension);
+	}
+	return nullptr;
+}
@@ -0,0 +1,138 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ENDIAN_SSE2 1
+#endif
+
+#include "Parallel.h"
+
+// VOL files store every multi-byte value big endian
+constexpr bool NATIVE_BIG_ENDIAN = std::endian::native == std::endian::big;
+
+constexpr uint16_t byteswap16(uint16_t value) {
+	return (uint16_t)((value << 8) | (value >> 8));
+}
+
+constexpr uint32_t byteswap32(uint32_t value) {
+	return (value << 24) | ((value << 8) & 0x00FF0000u) | ((value >> 8) & 0x0000FF00u) | (value >> 24);
+}
+
+/// <summary>
+/// Reads a big endian value of type T (2 or 4 bytes wide) from unaligned memory.
+/// </summary>
+template <typename T>
+T loadBigEndian(const unsigned char* bytes) {
+	static_assert(sizeof(T) == 2 || sizeof(T) == 4, "only 16 and 32 bit values are supported");
+	T value;
+	if constexpr (sizeof(T) == 2) {
+		uint16_t bits;
+		std::memcpy(&bits, bytes, 2);
+		if constexpr (!NATIVE_BIG_ENDIAN)
+			bits = byteswap16(bits);
+		std::memcpy(&value, &bits, 2);
+	}
+	else {
+		uint32_t bits;
+		std::memcpy(&bits, bytes, 4);
+		if constexpr (!NATIVE_BIG_ENDIAN)
+			bits = byteswap32(bits);
+		std::memcpy(&value, &bits, 4);
+	}
+	return value;
+}
+
+/// <summary>
+/// Writes a value of type T (2 or 4 bytes wide) big endian to unaligned memory.
+/// </summary>
+template <typename T>
+void storeBigEndian(T value, unsigned char* bytes) {
+	static_assert(sizeof(T) == 2 || sizeof(T) == 4, "only 16 and 32 bit values are supported");
+	if constexpr (sizeof(T) == 2) {
+		uint16_t bits;
+		std::memcpy(&bits, &value, 2);
+		if constexpr (!NATIVE_BIG_ENDIAN)
+			bits = byteswap16(bits);
+		std::memcpy(bytes, &bits, 2);
+	}
+	else {
+		uint32_t bits;
+		std::memcpy(&bits, &value, 4);
+		if constexpr (!NATIVE_BIG_ENDIAN)
+			bits = byteswap32(bits);
+		std::memcpy(bytes, &bits, 4);
+	}
+}
+
+/// <summary>
+/// Byte swaps count 16 bit values from source into destination, 8 at a time where SSE2 is available.
+/// </summary>
+void swapBytes16(const unsigned char* source, unsigned char* destination, size_t count) {
+	size_t i = 0;
+#ifdef ENDIAN_SSE2
+	for (; i + 8 <= count; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(source + 2 * i));
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		_mm_storeu_si128((__m128i*)(destination + 2 * i), v);
+	}
+#endif
+	for (; i < count; ++i) {
+		uint16_t bits;
+		std::memcpy(&bits, source + 2 * i, 2);
+		bits = byteswap16(bits);
+		std::memcpy(destination + 2 * i, &bits, 2);
+	}
+}
+
+/// <summary>
+/// Byte swaps count 32 bit values from source into destination, 4 at a time where SSE2 is available.
+/// </summary>
+void swapBytes32(const unsigned char* source, unsigned char* destination, size_t count) {
+	size_t i = 0;
+#ifdef ENDIAN_SSE2
+	for (; i + 4 <= count; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i*)(source + 4 * i));
+		// swap the bytes within each 16 bit half, then swap the two halves
+		v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+		v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+		v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+		_mm_storeu_si128((__m128i*)(destination + 4 * i), v);
+	}
+#endif
+	for (; i < count; ++i) {
+		uint32_t bits;
+		std::memcpy(&bits, source + 4 * i, 4);
+		bits = byteswap32(bits);
+		std::memcpy(destination + 4 * i, &bits, 4);
+	}
+}
+
+/// <summary>
+/// Converts count big endian values of value_size bytes each into native byte order, split across threads.
+/// Source and destination may be the same buffer.
+/// </summary>
+void bigEndianToNative(const unsigned char* source, unsigned char* destination, size_t count, size_t value_size) {
+	// chunks of 1 MiB keep every thread streaming through memory
+	const size_t chunk_values = (size_t(1) << 20) / value_size;
+	size_t chunks = (count + chunk_values - 1) / chunk_values;
+	parallelFor(0, chunks, [&](size_t chunk_begin, size_t chunk_end, unsigned int) {
+		size_t begin = chunk_begin * chunk_values;
+		size_t end = std::min(count, chunk_end * chunk_values);
+		const unsigned char* from = source + begin * value_size;
+		unsigned char* to = destination + begin * value_size;
+		if (NATIVE_BIG_ENDIAN || value_size == 1) {
+			if (from != to)
+				std::memmove(to, from, (end - begin) * value_size);
+		}
+		else if (value_size == 2) {
+			swapBytes16(from, to, end - begin);
+		}
+		else {
+			swapBytes32(from, to, end - begin);
+		}
+	});
+}
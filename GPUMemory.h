@@ -0,0 +1,113 @@
+#pragma once
+#include <GL/glew.h>
+
+#include <array>
+#include <unordered_map>
+
+enum class GPUMemoryCategory {
+	Volume,
+	TransferFunction,
+	Output,
+	Thumbnail,
+	Staging,
+	Count
+};
+
+const char* gpuMemoryCategoryName(GPUMemoryCategory category) {
+	switch (category) {
+		case GPUMemoryCategory::Volume: return "Volumes";
+		case GPUMemoryCategory::TransferFunction: return "Transfer function";
+		case GPUMemoryCategory::Output: return "Output images";
+		case GPUMemoryCategory::Thumbnail: return "Thumbnails";
+		case GPUMemoryCategory::Staging: return "Upload buffers";
+		case GPUMemoryCategory::Count: break;
+	}
+	return "";
+}
+
+/// <summary>
+/// The bytes per texel of the internal formats the visualizer allocates, 0 for any other format.
+/// </summary>
+size_t texelSize(GLint internal_format) {
+	switch (internal_format) {
+		case GL_R8: return 1;
+		case GL_R16: case GL_R16F: return 2;
+		case GL_R32F: case GL_RGBA8: return 4;
+		case GL_RGBA16F: return 8;
+		case GL_RGBA32F: return 16;
+	}
+	return 0;
+}
+
+/// <summary>
+/// Keeps account of the textures and buffers the visualizer allocates against a GPU memory budget.
+/// Objects are tracked by their GL name within their category, since textures and buffers share names.
+/// The budget is not enforced here, callers check fits() before allocating and evict or downsample otherwise.
+/// </summary>
+class GPUMemoryBudget {
+	public:
+		explicit GPUMemoryBudget(size_t budget_bytes) : budget(budget_bytes) {}
+
+		/// <summary>
+		/// Accounts for an allocated object, replacing its previous size if it is tracked already.
+		/// </summary>
+		void track(GLuint name, GPUMemoryCategory category, size_t bytes) {
+			untrack(name, category);
+			allocations[allocationKey(name, category)] = bytes;
+			used[(size_t)category] += bytes;
+		}
+
+		void untrack(GLuint name, GPUMemoryCategory category) {
+			auto allocation = allocations.find(allocationKey(name, category));
+			if (allocation == allocations.end())
+				return;
+			used[(size_t)category] -= allocation->second;
+			allocations.erase(allocation);
+		}
+
+		/// <summary>
+		/// Deletes a texture and stops accounting for it.
+		/// </summary>
+		void deleteTexture(GLuint& texture, GPUMemoryCategory category) {
+			if (texture == 0)
+				return;
+			untrack(texture, category);
+			glDeleteTextures(1, &texture);
+			texture = 0;
+		}
+
+		/// <summary>
+		/// Whether another bytes fit in the budget next to everything tracked.
+		/// </summary>
+		bool fits(size_t bytes) const {
+			return usedBytes() + bytes <= budget;
+		}
+
+		size_t usedBytes() const {
+			size_t total = 0;
+			for (size_t bytes : used)
+				total += bytes;
+			return total;
+		}
+
+		size_t usedBytes(GPUMemoryCategory category) const {
+			return used[(size_t)category];
+		}
+
+		size_t budgetBytes() const {
+			return budget;
+		}
+
+		void setBudget(size_t budget_bytes) {
+			budget = budget_bytes;
+		}
+
+	private:
+		size_t budget;
+		std::unordered_map<unsigned long long, size_t> allocations;
+		std::array<size_t, (size_t)GPUMemoryCategory::Count> used{};
+
+		static unsigned long long allocationKey(GLuint name, GPUMemoryCategory category) {
+			return ((unsigned long long)category << 32) | name;
+		}
+};
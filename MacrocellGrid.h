@@ -0,0 +1,232 @@
+#pragma once
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include "Parallel.h"
+#include "VOLParser.h"
+
+// voxels per side of a macrocell
+const int MACROCELL_SIZE = 8;
+
+/// <summary>
+/// The range of values within every macrocell of a volume, so the renderer can tell which cells a transfer function leaves transparent.
+/// A range covers the voxel border around its cell too, since trilinear samples in a cell reach half a voxel past it.
+/// </summary>
+struct MacrocellGrid {
+	glm::ivec3 cell_count = glm::ivec3(0);
+	// the min and max value of each cell in the units of the voxel type, x fastest
+	std::vector<glm::vec2> ranges;
+
+	size_t cellCount() const {
+		return (size_t)cell_count.x * cell_count.y * cell_count.z;
+	}
+};
+
+template <typename T>
+void buildTypedMacrocellGrid(const T* values, glm::ivec3 resolution, MacrocellGrid& grid) {
+	parallelFor(0, grid.cell_count.z, [&](size_t z_begin, size_t z_end, unsigned int) {
+		for (int cell_z = (int)z_begin; cell_z < (int)z_end; ++cell_z) {
+			for (int cell_y = 0; cell_y < grid.cell_count.y; ++cell_y) {
+				for (int cell_x = 0; cell_x < grid.cell_count.x; ++cell_x) {
+					glm::ivec3 cell(cell_x, cell_y, cell_z);
+					glm::ivec3 begin = glm::max(cell * MACROCELL_SIZE - 1, glm::ivec3(0));
+					glm::ivec3 end = glm::min((cell + 1) * MACROCELL_SIZE + 1, resolution);
+					T low = values[((size_t)begin.z * resolution.y + begin.y) * resolution.x + begin.x], high = low;
+					for (int z = begin.z; z < end.z; ++z) {
+						for (int y = begin.y; y < end.y; ++y) {
+							const T* row = values + ((size_t)z * resolution.y + y) * resolution.x;
+							for (int x = begin.x; x < end.x; ++x) {
+								low = std::min(low, row[x]);
+								high = std::max(high, row[x]);
+							}
+						}
+					}
+					grid.ranges[((size_t)cell_z * grid.cell_count.y + cell_y) * grid.cell_count.x + cell_x] = glm::vec2((float)low, (float)high);
+				}
+			}
+		}
+	});
+}
+
+/// <summary>
+/// Builds the macrocell grid of a volume from its dense values.
+/// </summary>
+/// <returns>The grid, nullptr if the volume has no dense values.</returns>
+std::shared_ptr<const MacrocellGrid> buildMacrocellGrid(const VOLData& data) {
+	if (data.values.size() < voxelCount(data) * voxelSize(data.voxel_type) || voxelCount(data) == 0)
+		return nullptr;
+
+	auto grid = std::make_shared<MacrocellGrid>();
+	grid->cell_count = (data.resolution + MACROCELL_SIZE - 1) / MACROCELL_SIZE;
+	grid->ranges.resize(grid->cellCount());
+	switch (data.voxel_type) {
+		case VoxelType::UInt8: buildTypedMacrocellGrid(data.values.data(), data.resolution, *grid); break;
+		case VoxelType::UInt16: buildTypedMacrocellGrid((const unsigned short*)data.values.data(), data.resolution, *grid); break;
+		case VoxelType::Float32: buildTypedMacrocellGrid((const float*)data.values.data(), data.resolution, *grid); break;
+	}
+	return grid;
+}
+
+/// <summary>
+/// Which macrocells a transfer function shows anything of: a cell is visible if any table entry its value range maps to,
+/// or the neighbour a linearly filtered lookup blends in, has a non-zero opacity.
+/// </summary>
+/// <param name="table">The transfer function table, sampled over domain.</param>
+/// <param name="domain">The values the first and the last table entry stand for, see transferFunctionDomain.</param>
+/// <returns>A byte per cell, 1 if visible, x fastest.</returns>
+std::vector<unsigned char> macrocellVisibility(const MacrocellGrid& grid, const std::vector<glm::vec4>& table, glm::vec2 domain) {
+	// opaque[i] counts the entries before i with a non-zero opacity, so any range is checked in constant time
+	int table_size = (int)table.size();
+	std::vector<int> opaque(table_size + 1, 0);
+	for (int i = 0; i < table_size; ++i)
+		opaque[i + 1] = opaque[i] + (table[i].a > 0.0f ? 1 : 0);
+
+	float scale = table_size / (domain.y - domain.x);
+	std::vector<unsigned char> visibility(grid.cellCount());
+	parallelFor(0, grid.cellCount(), [&](size_t begin, size_t end, unsigned int) {
+		for (size_t cell = begin; cell < end; ++cell) {
+			glm::vec2 range = grid.ranges[cell];
+			// texel centres are at (i + 0.5) / table_size, a lookup between two of them blends both,
+			// and one more entry on either side covers the rounding of the shader
+			int first = std::clamp((int)std::floor((range.x - domain.x) * scale - 0.5f) - 1, 0, table_size - 1);
+			int last = std::clamp((int)std::floor((range.y - domain.x) * scale - 0.5f) + 2, 0, table_size - 1);
+			visibility[cell] = opaque[last + 1] - opaque[first] > 0 ? 1 : 0;
+		}
+	});
+	return visibility;
+}
+
+// the furthest a leap reaches, in macrocells: distances are capped here, so a change in visibility only moves
+// the distances of the cells this close to it, and a distance fits in a byte
+const int MACROCELL_MAX_DISTANCE = 16;
+
+/// <summary>
+/// The Chebyshev distance, in macrocells, from every macrocell to the nearest visible one, capped at MACROCELL_MAX_DISTANCE.
+/// All cells closer than its distance to a cell are invisible, so a ray leaps through that block of cells at once.
+/// The transform is separable, one pass per axis, and a new visibility only recomputes the region around the cells that changed.
+/// </summary>
+class MacrocellDistanceMap {
+	public:
+		/// <summary>
+		/// Brings the distances up to date with a new visibility (see macrocellVisibility).
+		/// </summary>
+		/// <param name="changed_begin">Receives the first cell of the box whose distances were recomputed.</param>
+		/// <param name="changed_end">Receives the end of that box, exclusive.</param>
+		/// <returns>Whether any distance was recomputed.</returns>
+		bool update(const std::vector<unsigned char>& new_visibility, glm::ivec3 new_cell_count, glm::ivec3& changed_begin, glm::ivec3& changed_end) {
+			if (new_cell_count != cell_count || new_visibility.size() != visibility.size()) {
+				cell_count = new_cell_count;
+				visibility = new_visibility;
+				cell_distances.assign(visibility.size(), 0);
+				changed_begin = glm::ivec3(0);
+				changed_end = cell_count;
+				recompute(changed_begin, changed_end);
+				return !visibility.empty();
+			}
+
+			changed_begin = cell_count;
+			changed_end = glm::ivec3(0);
+			for (int z = 0; z < cell_count.z; ++z) {
+				for (int y = 0; y < cell_count.y; ++y) {
+					size_t row = ((size_t)z * cell_count.y + y) * cell_count.x;
+					for (int x = 0; x < cell_count.x; ++x) {
+						if (visibility[row + x] != new_visibility[row + x]) {
+							changed_begin = glm::min(changed_begin, glm::ivec3(x, y, z));
+							changed_end = glm::max(changed_end, glm::ivec3(x, y, z) + 1);
+						}
+					}
+				}
+			}
+			if (glm::any(glm::greaterThanEqual(changed_begin, changed_end)))
+				return false;
+
+			visibility = new_visibility;
+			changed_begin = glm::max(changed_begin - MACROCELL_MAX_DISTANCE, glm::ivec3(0));
+			changed_end = glm::min(changed_end + MACROCELL_MAX_DISTANCE, cell_count);
+			recompute(changed_begin, changed_end);
+			return true;
+		}
+
+		/// <summary>
+		/// The distances of a box of cells, x fastest, e.g. to upload what update() changed.
+		/// </summary>
+		std::vector<unsigned char> distances(glm::ivec3 begin, glm::ivec3 end) const {
+			glm::ivec3 size = end - begin;
+			std::vector<unsigned char> box((size_t)size.x * size.y * size.z);
+			for (int z = 0; z < size.z; ++z) {
+				for (int y = 0; y < size.y; ++y) {
+					const unsigned char* row = cell_distances.data() + ((size_t)(begin.z + z) * cell_count.y + begin.y + y) * cell_count.x + begin.x;
+					std::copy(row, row + size.x, box.begin() + ((size_t)z * size.y + y) * size.x);
+				}
+			}
+			return box;
+		}
+
+		glm::ivec3 cellCount() const {
+			return cell_count;
+		}
+
+	private:
+		glm::ivec3 cell_count = glm::ivec3(0);
+		std::vector<unsigned char> visibility;
+		std::vector<unsigned char> cell_distances;
+
+		// one pass of the transform along a line: out[i] = min over j of max(|i - j|, in[j]), capped at MACROCELL_MAX_DISTANCE
+		static void transformLine(unsigned char* line, int length, size_t stride, std::vector<unsigned char>& scratch) {
+			scratch.resize(length);
+			for (int i = 0; i < length; ++i)
+				scratch[i] = line[i * stride];
+			for (int i = 0; i < length; ++i) {
+				int best = scratch[i];
+				for (int k = 1; k < best; ++k) {
+					int nearest = std::min(i - k >= 0 ? scratch[i - k] : MACROCELL_MAX_DISTANCE, i + k < length ? scratch[i + k] : MACROCELL_MAX_DISTANCE);
+					best = std::min(best, std::max(k, nearest));
+				}
+				line[i * stride] = (unsigned char)best;
+			}
+		}
+
+		// recomputes the distances of a box of cells from the visibility of the box widened by the largest distance
+		void recompute(glm::ivec3 begin, glm::ivec3 end) {
+			glm::ivec3 padded_begin = glm::max(begin - MACROCELL_MAX_DISTANCE, glm::ivec3(0));
+			glm::ivec3 padded_end = glm::min(end + MACROCELL_MAX_DISTANCE, cell_count);
+			glm::ivec3 size = padded_end - padded_begin;
+			if (glm::any(glm::lessThanEqual(size, glm::ivec3(0))))
+				return;
+
+			std::vector<unsigned char> work((size_t)size.x * size.y * size.z);
+			for (int z = 0; z < size.z; ++z) {
+				for (int y = 0; y < size.y; ++y) {
+					for (int x = 0; x < size.x; ++x) {
+						size_t cell = ((size_t)(padded_begin.z + z) * cell_count.y + padded_begin.y + y) * cell_count.x + padded_begin.x + x;
+						work[((size_t)z * size.y + y) * size.x + x] = visibility[cell] ? 0 : MACROCELL_MAX_DISTANCE;
+					}
+				}
+			}
+
+			const size_t strides[3] = { 1, (size_t)size.x, (size_t)size.x * size.y };
+			for (int axis = 0; axis < 3; ++axis) {
+				// the lines along an axis start at every cell of the face across it
+				int u_axis = (axis + 1) % 3, v_axis = (axis + 2) % 3;
+				size_t line_count = (size_t)size[u_axis] * size[v_axis];
+				parallelFor(0, line_count, [&](size_t line_begin, size_t line_end, unsigned int) {
+					std::vector<unsigned char> scratch;
+					for (size_t line = line_begin; line < line_end; ++line) {
+						size_t u = line % size[u_axis], v = line / size[u_axis];
+						transformLine(work.data() + u * strides[u_axis] + v * strides[v_axis], size[axis], strides[axis], scratch);
+					}
+				});
+			}
+
+			for (int z = begin.z; z < end.z; ++z) {
+				for (int y = begin.y; y < end.y; ++y) {
+					const unsigned char* row = work.data() + ((size_t)(z - padded_begin.z) * size.y + y - padded_begin.y) * size.x + begin.x - padded_begin.x;
+					std::copy(row, row + end.x - begin.x, cell_distances.begin() + ((size_t)z * cell_count.y + y) * cell_count.x + begin.x);
+				}
+			}
+		}
+};
@@ -0,0 +1,144 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// <summary>
+/// The number of worker threads parallelFor splits its work across.
+/// </summary>
+unsigned int parallelThreadCount() {
+	return std::max(1u, std::thread::hardware_concurrency());
+}
+
+/// <summary>
+/// A fixed set of worker threads that runs batches of tasks. The thread submitting a batch works on it too,
+/// so batches submitted from inside a task, or from several threads at once, always complete.
+/// </summary>
+class ThreadPool {
+	public:
+		explicit ThreadPool(unsigned int worker_count) {
+			for (unsigned int i = 0; i < worker_count; ++i)
+				workers.emplace_back(&ThreadPool::work, this);
+		}
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		~ThreadPool() {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			wake.notify_all();
+			for (std::thread& worker : workers)
+				worker.join();
+		}
+
+		/// <summary>
+		/// Runs task(0) ... task(count - 1) on the workers and the calling thread, returning once all of them are done.
+		/// </summary>
+		void run(size_t count, const std::function<void(size_t)>& task) {
+			if (count == 0)
+				return;
+			std::shared_ptr<Batch> batch = std::make_shared<Batch>(task, count);
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				batches.push_back(batch);
+			}
+			wake.notify_all();
+
+			while (runNext(*batch)) {}
+
+			std::unique_lock<std::mutex> lock(mutex);
+			finished.wait(lock, [&]() { return batch->done == batch->count; });
+			auto queued = std::find(batches.begin(), batches.end(), batch);
+			if (queued != batches.end())
+				batches.erase(queued);
+		}
+
+	private:
+		struct Batch {
+			const std::function<void(size_t)>& task;
+			size_t count;
+			std::atomic<size_t> next{ 0 };
+			std::atomic<size_t> done{ 0 };
+
+			Batch(const std::function<void(size_t)>& batch_task, size_t task_count) : task(batch_task), count(task_count) {}
+		};
+
+		std::vector<std::thread> workers;
+		std::mutex mutex;
+		std::condition_variable wake, finished;
+		std::deque<std::shared_ptr<Batch>> batches;
+		bool stopping = false;
+
+		// claims and runs one task of the batch, false once every task has been claimed
+		bool runNext(Batch& batch) {
+			size_t index = batch.next++;
+			if (index >= batch.count)
+				return false;
+			batch.task(index);
+			if (++batch.done == batch.count) {
+				std::lock_guard<std::mutex> lock(mutex);
+				finished.notify_all();
+			}
+			return true;
+		}
+
+		void work() {
+			while (true) {
+				std::shared_ptr<Batch> batch;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					wake.wait(lock, [&]() { return stopping || !batches.empty(); });
+					if (stopping)
+						return;
+					batch = batches.front();
+					// a batch whose tasks are all claimed leaves the queue, the submitter waits for the rest to finish
+					if (batch->next >= batch->count) {
+						batches.pop_front();
+						continue;
+					}
+				}
+				runNext(*batch);
+			}
+		}
+};
+
+/// <summary>
+/// The pool parallelFor runs on, created on first use. The calling thread is the last of its parallelThreadCount() threads.
+/// </summary>
+ThreadPool& sharedThreadPool() {
+	static ThreadPool pool(parallelThreadCount() - 1);
+	return pool;
+}
+
+/// <summary>
+/// Splits [begin, end) into one contiguous range per worker thread and runs them concurrently, returning once all are done.
+/// </summary>
+/// <param name="begin">The first index.</param>
+/// <param name="end">One past the last index.</param>
+/// <param name="body">Called as body(range_begin, range_end, thread_index) where thread_index is below parallelThreadCount()
+/// and unique among the ranges of one call.</param>
+void parallelFor(size_t begin, size_t end, const std::function<void(size_t, size_t, unsigned int)>& body) {
+	if (end <= begin)
+		return;
+	size_t count = end - begin;
+	unsigned int thread_count = (unsigned int)std::min<size_t>(parallelThreadCount(), count);
+	if (thread_count == 1) {
+		body(begin, end, 0);
+		return;
+	}
+
+	sharedThreadPool().run(thread_count, [&](size_t i) {
+		size_t range_begin = begin + i * (count / thread_count) + std::min<size_t>(i, count % thread_count);
+		size_t range_end = range_begin + count / thread_count + (i < count % thread_count ? 1 : 0);
+		body(range_begin, range_end, (unsigned int)i);
+	});
+}
@@ -0,0 +1,152 @@
+#pragma once
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "Parallel.h"
+
+// entries per side of the pre-integrated table, its coordinates are the transfer function coordinates of the front and the back sample
+const int PREINTEGRATION_SIZE = 256;
+// the running integrals are kept at this many points between two transfer function entries, the extinction is not linear in the opacity
+const int PREINTEGRATION_SUBDIVISIONS = 8;
+
+/// <summary>
+/// The transfer function integrated over every segment between a front and a back value, so a large step still sees the
+/// thin features of the transfer function between the values at its ends. The value is taken to vary linearly along a segment,
+/// and self-attenuation within it is neglected, so every entry comes from differences of two running integrals.
+/// An entry holds the extinction-weighted mean colour in rgb and the opacity of a segment as long as the step the table opacities are for in a.
+/// </summary>
+class PreIntegrationTable {
+	public:
+		/// <summary>
+		/// Brings the table up to date with a transfer function, only recomputing the segments whose values span a changed entry.
+		/// </summary>
+		/// <param name="table">The transfer function table, as the 1D texture samples it.</param>
+		/// <returns>Whether any entry was recomputed.</returns>
+		bool update(const std::vector<glm::vec4>& table) {
+			int table_size = (int)table.size();
+			if (table_size == 0)
+				return false;
+
+			// the entries of the transfer function that changed, everything if its size did
+			int first = 0, last = table_size - 1;
+			if (table_size == (int)transfer_function.size()) {
+				while (first < table_size && table[first] == transfer_function[first])
+					++first;
+				if (first == table_size)
+					return false;
+				while (table[last] == transfer_function[last])
+					--last;
+			}
+			else
+				entries.assign((size_t)PREINTEGRATION_SIZE * PREINTEGRATION_SIZE, glm::vec4(0.0f));
+			transfer_function = table;
+			integrate();
+
+			// a segment whose ends both lie before the changed entries, or both after them, integrates the same as before
+			std::vector<float> positions(PREINTEGRATION_SIZE);
+			for (int i = 0; i < PREINTEGRATION_SIZE; ++i)
+				positions[i] = tablePosition((i + 0.5f) / PREINTEGRATION_SIZE);
+			auto unchanged = [&](int front, int back) {
+				bool before = positions[front] <= first - 1 && positions[back] <= first - 1;
+				bool after = positions[front] >= last + 1 && positions[back] >= last + 1;
+				return before || after;
+			};
+
+			parallelFor(0, PREINTEGRATION_SIZE, [&](size_t begin, size_t end, unsigned int) {
+				for (size_t front = begin; front < end; ++front) {
+					for (int back = 0; back < PREINTEGRATION_SIZE; ++back) {
+						if (!unchanged((int)front, back))
+							entries[front * PREINTEGRATION_SIZE + back] = segment(positions[front], positions[back]);
+					}
+				}
+			});
+			return true;
+		}
+
+		/// <summary>
+		/// The entries, the back value fastest, as a PREINTEGRATION_SIZE square texture takes them.
+		/// </summary>
+		const std::vector<glm::vec4>& data() const {
+			return entries;
+		}
+
+	private:
+		std::vector<glm::vec4> transfer_function;
+		// the running integrals of the extinction and of the extinction-weighted colour, from the centre of the first transfer function entry
+		// at PREINTEGRATION_SUBDIVISIONS points per entry
+		std::vector<float> extinction_integral;
+		std::vector<glm::vec3> color_integral;
+		std::vector<glm::vec4> entries;
+
+		// where a transfer function coordinate falls between the entries, as the linear filtering of the 1D texture places it
+		float tablePosition(float coordinate) const {
+			return coordinate * transfer_function.size() - 0.5f;
+		}
+
+		// the extinction of a segment as long as the reference step in an entry of constant opacity
+		static float extinction(float opacity) {
+			return -std::log(1.0f - std::min(opacity, 0.9999f));
+		}
+
+		// the trapezoid integrals over the transfer function as the linear filtering interpolates it, in entries
+		void integrate() {
+			int table_size = (int)transfer_function.size();
+			int point_count = (table_size - 1) * PREINTEGRATION_SUBDIVISIONS + 1;
+			extinction_integral.assign(point_count, 0.0f);
+			color_integral.assign(point_count, glm::vec3(0.0f));
+			glm::vec4 previous = transfer_function[0];
+			float previous_extinction = extinction(previous.a);
+			for (int i = 1; i < point_count; ++i) {
+				glm::vec4 current = sampleAt((float)i / PREINTEGRATION_SUBDIVISIONS);
+				float current_extinction = extinction(current.a);
+				float width = 1.0f / PREINTEGRATION_SUBDIVISIONS;
+				extinction_integral[i] = extinction_integral[i - 1] + 0.5f * width * (previous_extinction + current_extinction);
+				color_integral[i] = color_integral[i - 1] + 0.5f * width * (previous_extinction * glm::vec3(previous) + current_extinction * glm::vec3(current));
+				previous = current;
+				previous_extinction = current_extinction;
+			}
+		}
+
+		// the running integrals at a position between the entries, the ends of the table extend as constants
+		void integralsAt(float position, float& extinction_value, glm::vec3& color_value) const {
+			int table_size = (int)transfer_function.size(), point_count = (int)extinction_integral.size();
+			float clamped = std::clamp(position, 0.0f, (float)(table_size - 1));
+			float point = clamped * PREINTEGRATION_SUBDIVISIONS;
+			int lower = std::min((int)point, point_count - 1), upper = std::min(lower + 1, point_count - 1);
+			float fraction = point - lower;
+			extinction_value = extinction_integral[lower] + fraction * (extinction_integral[upper] - extinction_integral[lower]);
+			color_value = color_integral[lower] + fraction * (color_integral[upper] - color_integral[lower]);
+
+			const glm::vec4& edge = transfer_function[position < 0.0f ? 0 : table_size - 1];
+			float outside = position - clamped;
+			extinction_value += outside * extinction(edge.a);
+			color_value += outside * extinction(edge.a) * glm::vec3(edge);
+		}
+
+		glm::vec4 sampleAt(float position) const {
+			int table_size = (int)transfer_function.size();
+			float clamped = std::clamp(position, 0.0f, (float)(table_size - 1));
+			int lower = std::min((int)clamped, table_size - 1), upper = std::min(lower + 1, table_size - 1);
+			return glm::mix(transfer_function[lower], transfer_function[upper], clamped - lower);
+		}
+
+		glm::vec4 segment(float front, float back) const {
+			// a segment of nearly constant value is a point sample
+			if (std::abs(back - front) < 1e-3f)
+				return sampleAt(0.5f * (front + back));
+
+			float front_extinction, back_extinction;
+			glm::vec3 front_color, back_color;
+			integralsAt(front, front_extinction, front_color);
+			integralsAt(back, back_extinction, back_color);
+			float extinction_sum = back_extinction - front_extinction;
+			if (std::abs(extinction_sum) < 1e-6f)
+				return glm::vec4(glm::vec3(sampleAt(0.5f * (front + back))), 0.0f);
+
+			float mean_extinction = extinction_sum / (back - front);
+			return glm::vec4((back_color - front_color) / extinction_sum, 1.0f - std::exp(-mean_extinction));
+		}
+};
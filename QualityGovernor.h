@@ -0,0 +1,115 @@
+#pragma once
+#include <limits>
+
+// the samples per pixel side of a full quality frame that is not refined progressively
+const int FULL_SAMPLES_PER_SIDE = 2;
+
+/// <summary>
+/// What the raytracer gives up while the view is being changed, so it keeps up with the input.
+/// </summary>
+struct InteractionQuality {
+	// the internal render resolution relative to the window, the image is upscaled to it
+	float resolution_scale;
+	// samples per pixel side when not refining progressively, a progressive frame always takes one
+	int samples_per_side;
+	// multiplies the samples per voxel of the sampling quality
+	float step_scale;
+};
+
+// from the least to the most reduced, the governor moves along these one at a time
+const InteractionQuality INTERACTION_QUALITIES[] = {
+	{ 1.0f, FULL_SAMPLES_PER_SIDE, 1.0f },
+	{ 1.0f, 1, 1.0f },
+	{ 0.75f, 1, 1.0f },
+	{ 0.75f, 1, 0.75f },
+	{ 0.5f, 1, 0.75f },
+	{ 0.5f, 1, 0.5f },
+	{ 0.35f, 1, 0.5f },
+	{ 0.25f, 1, 0.5f },
+};
+const int INTERACTION_QUALITY_COUNT = sizeof(INTERACTION_QUALITIES) / sizeof(INTERACTION_QUALITIES[0]);
+
+/// <summary>
+/// Holds the frame time to a budget while the user interacts, by moving along INTERACTION_QUALITIES from the measured frame times,
+/// and restores the full quality once the input stops. The level reached is kept for the next interaction, as it mostly depends on the scene.
+/// </summary>
+class QualityGovernor {
+	public:
+		// the time to hold tracing an image to during interaction, in milliseconds
+		float budget_ms = 1000.0f / 30.0f;
+		// seconds without input after which an interaction is over
+		double settle_seconds = 0.25;
+
+		/// <summary>
+		/// Notes input that changes the image, starting or extending an interaction.
+		/// </summary>
+		void input(double now) {
+			last_input = now;
+		}
+
+		bool interacting(double now) const {
+			return now - last_input < settle_seconds;
+		}
+
+		/// <summary>
+		/// Advances the governor by a frame.
+		/// </summary>
+		/// <param name="now">The time of the frame in seconds.</param>
+		/// <param name="frame_ms">The time tracing a whole image takes at the current quality, in milliseconds.</param>
+		/// <returns>Whether the quality the image is traced at changed, because the level moved or the interaction ended.</returns>
+		bool update(double now, double frame_ms) {
+			bool active = interacting(now);
+			bool changed = false;
+			// the time measured before an interaction is of the full quality, only the ones during it are of the current level
+			if (active && was_interacting) {
+				average_ms = frames_at_level == 0 ? frame_ms : average_ms + AVERAGE_WEIGHT * (frame_ms - average_ms);
+				// a new level is given a few frames to show its cost before moving again
+				if (++frames_at_level >= FRAMES_PER_DECISION) {
+					if (average_ms > budget_ms * SLOW_MARGIN && level < INTERACTION_QUALITY_COUNT - 1) {
+						++level;
+						changed = true;
+					}
+					else if (average_ms < budget_ms * FAST_MARGIN && level > 0) {
+						--level;
+						changed = true;
+					}
+					if (changed)
+						frames_at_level = 0;
+				}
+			}
+			if (was_interacting && !active)
+				changed = true;
+			was_interacting = active;
+			return changed;
+		}
+
+		/// <summary>
+		/// The quality to trace at, the full one outside of interactions.
+		/// </summary>
+		InteractionQuality quality(double now) const {
+			if (!interacting(now))
+				return InteractionQuality{ 1.0f, FULL_SAMPLES_PER_SIDE, 1.0f };
+			return INTERACTION_QUALITIES[level];
+		}
+
+		int currentLevel() const {
+			return level;
+		}
+
+		double averageFrameMilliseconds() const {
+			return average_ms;
+		}
+
+	private:
+		static constexpr double AVERAGE_WEIGHT = 0.25;
+		static constexpr int FRAMES_PER_DECISION = 4;
+		// a level is reduced above this fraction of the budget and raised again below the other, the gap keeps it from oscillating
+		static constexpr double SLOW_MARGIN = 1.15;
+		static constexpr double FAST_MARGIN = 0.6;
+
+		double last_input = -std::numeric_limits<double>::infinity();
+		bool was_interacting = false;
+		int level = 0;
+		int frames_at_level = 0;
+		double average_ms = 0.0;
+};
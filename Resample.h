@@ -0,0 +1,314 @@
+#pragma once
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "Parallel.h"
+#include "VOLParser.h"
+
+enum class ResampleFilter {
+	Trilinear,
+	Lanczos
+};
+
+const char* resampleFilterName(ResampleFilter filter) {
+	switch (filter) {
+		case ResampleFilter::Trilinear: return "Trilinear";
+		case ResampleFilter::Lanczos: return "Lanczos";
+	}
+	return "";
+}
+
+/// <summary>
+/// Limits a volume has to fit in once it is loaded. A limit of 0 is no limit.
+/// </summary>
+struct ResampleBudget {
+	size_t max_voxels = 0;
+	// the size of the voxel values, in the voxel type of the file, plus extra_voxel_bytes per voxel
+	size_t max_bytes = 0;
+	// bytes kept per voxel next to the values, e.g. its gradient
+	size_t extra_voxel_bytes = 0;
+	// the largest side, e.g. GL_MAX_3D_TEXTURE_SIZE
+	int max_dimension = 0;
+	// resample voxels that are longer along one axis than the others to cubes of the shortest side
+	bool isotropic = true;
+	// spacings differing by less than this fraction count as isotropic already
+	float anisotropy_tolerance = 0.01f;
+	ResampleFilter filter = ResampleFilter::Lanczos;
+};
+
+/// <summary>
+/// The resolution a volume is resampled to and why.
+/// </summary>
+struct ResamplePlan {
+	glm::ivec3 source_resolution = glm::ivec3(0);
+	glm::ivec3 resolution = glm::ivec3(0);
+	ResampleFilter filter = ResampleFilter::Lanczos;
+	bool made_isotropic = false;
+	bool fit_to_budget = false;
+
+	bool needed() const {
+		return resolution != source_resolution;
+	}
+
+	std::string describe() const {
+		std::ostringstream text;
+		text << source_resolution.x << "x" << source_resolution.y << "x" << source_resolution.z;
+		if (!needed())
+			return text.str() + " (native)";
+		text << " -> " << resolution.x << "x" << resolution.y << "x" << resolution.z << " (" << resampleFilterName(filter);
+		if (made_isotropic)
+			text << ", isotropic";
+		if (fit_to_budget)
+			text << ", downsampled to budget";
+		text << ")";
+		return text.str();
+	}
+};
+
+/// <summary>
+/// Chooses the resolution a volume is loaded at: isotropic voxels if the budget asks for them, then scaled down uniformly until
+/// it fits the voxel, byte and dimension limits. The physical extent (true_size) stays the same.
+/// </summary>
+ResamplePlan planResample(const VOLData& data, const ResampleBudget& budget) {
+	ResamplePlan plan;
+	plan.source_resolution = data.resolution;
+	plan.resolution = data.resolution;
+	plan.filter = budget.filter;
+	if (data.resolution.x <= 0 || data.resolution.y <= 0 || data.resolution.z <= 0)
+		return plan;
+
+	glm::dvec3 resolution = glm::dvec3(data.resolution);
+	glm::dvec3 spacing = glm::dvec3(data.true_size) / resolution;
+	double finest = std::min(spacing.x, std::min(spacing.y, spacing.z));
+	double coarsest = std::max(spacing.x, std::max(spacing.y, spacing.z));
+	if (budget.isotropic && finest > 0.0 && coarsest > finest * (1.0 + budget.anisotropy_tolerance)) {
+		resolution = glm::dvec3(data.true_size) / finest;
+		plan.made_isotropic = true;
+	}
+
+	size_t max_voxels = budget.max_voxels;
+	if (budget.max_bytes > 0) {
+		size_t byte_voxels = budget.max_bytes / (voxelSize(data.voxel_type) + budget.extra_voxel_bytes);
+		max_voxels = max_voxels > 0 ? std::min(max_voxels, byte_voxels) : byte_voxels;
+	}
+	double scale = 1.0;
+	double count = resolution.x * resolution.y * resolution.z;
+	if (max_voxels > 0 && count > (double)max_voxels)
+		scale = std::cbrt((double)max_voxels / count);
+	double largest = std::max(resolution.x, std::max(resolution.y, resolution.z));
+	if (budget.max_dimension > 0 && largest * scale > budget.max_dimension)
+		scale = budget.max_dimension / largest;
+
+	auto target = [&](double scale) {
+		return glm::max(glm::ivec3(glm::round(resolution * scale)), glm::ivec3(1));
+	};
+	plan.resolution = target(scale);
+	// rounding can leave the volume just over the budget
+	auto fits = [&](glm::ivec3 candidate) {
+		size_t candidate_count = (size_t)candidate.x * candidate.y * candidate.z;
+		return (max_voxels == 0 || candidate_count <= max_voxels) &&
+			(budget.max_dimension == 0 || std::max(candidate.x, std::max(candidate.y, candidate.z)) <= budget.max_dimension);
+	};
+	while (!fits(plan.resolution) && plan.resolution != glm::ivec3(1)) {
+		scale *= 0.99;
+		plan.resolution = target(scale);
+	}
+	plan.fit_to_budget = scale < 1.0;
+	if (plan.made_isotropic && !plan.fit_to_budget && plan.resolution == data.resolution)
+		plan.made_isotropic = false;
+	return plan;
+}
+
+/// <summary>
+/// The filter taps of one axis: output sample i is the sum of weights[first[i] .. first[i + 1]) times the source samples at index[...].
+/// </summary>
+struct ResampleTaps {
+	std::vector<size_t> first;
+	std::vector<int> index;
+	std::vector<float> weights;
+};
+
+double resampleKernel(ResampleFilter filter, double x) {
+	x = std::abs(x);
+	if (filter == ResampleFilter::Trilinear)
+		return x < 1.0 ? 1.0 - x : 0.0;
+
+	const double lobes = 3.0, pi = 3.14159265358979323846;
+	if (x < 1e-8)
+		return 1.0;
+	if (x >= lobes)
+		return 0.0;
+	return lobes * std::sin(pi * x) * std::sin(pi * x / lobes) / (pi * pi * x * x);
+}
+
+double resampleKernelRadius(ResampleFilter filter) {
+	return filter == ResampleFilter::Trilinear ? 1.0 : 3.0;
+}
+
+/// <summary>
+/// Computes the taps for resampling an axis of source_size samples to target_size samples over the same extent.
+/// When downsampling the kernel is stretched by the reduction so that every source sample contributes and nothing aliases.
+/// </summary>
+ResampleTaps computeResampleTaps(int source_size, int target_size, ResampleFilter filter) {
+	ResampleTaps taps;
+	double ratio = (double)source_size / target_size;
+	double stretch = std::max(1.0, ratio);
+	double radius = resampleKernelRadius(filter) * stretch;
+	taps.first.push_back(0);
+	for (int i = 0; i < target_size; ++i) {
+		// sample centres line up with the edges of the volume, as in the texture sampler
+		double center = (i + 0.5) * ratio - 0.5;
+		int begin = (int)std::ceil(center - radius), end = (int)std::floor(center + radius);
+		size_t tap_begin = taps.weights.size();
+		double total = 0.0;
+		for (int s = begin; s <= end; ++s) {
+			double weight = resampleKernel(filter, (s - center) / stretch);
+			if (weight == 0.0)
+				continue;
+			taps.index.push_back(std::clamp(s, 0, source_size - 1));
+			taps.weights.push_back((float)weight);
+			total += weight;
+		}
+		if (total == 0.0) {
+			taps.index.push_back(std::clamp((int)std::round(center), 0, source_size - 1));
+			taps.weights.push_back(1.0f);
+		}
+		else {
+			for (size_t t = tap_begin; t < taps.weights.size(); ++t)
+				taps.weights[t] = (float)(taps.weights[t] / total);
+		}
+		taps.first.push_back(taps.weights.size());
+	}
+	return taps;
+}
+
+template<typename T>
+T resampledValue(float value) {
+	if constexpr (std::is_integral_v<T>)
+		return (T)std::clamp(std::round(value), 0.0f, (float)std::numeric_limits<T>::max());
+	else
+		return (T)value;
+}
+
+/// <summary>
+/// Filters a source slice along x and then y into a slice of the target size.
+/// </summary>
+/// <param name="rows">Scratch space, resized to the target width times the source height.</param>
+template<typename T>
+void resampleSlice(const T* source_slice, glm::ivec2 source, glm::ivec2 target, const ResampleTaps& x_taps, const ResampleTaps& y_taps,
+	std::vector<float>& rows, float* plane) {
+	rows.resize((size_t)target.x * source.y);
+	for (int y = 0; y < source.y; ++y) {
+		const T* row = source_slice + (size_t)y * source.x;
+		float* filtered = rows.data() + (size_t)y * target.x;
+		for (int x = 0; x < target.x; ++x) {
+			float sum = 0.0f;
+			for (size_t t = x_taps.first[x]; t < x_taps.first[x + 1]; ++t)
+				sum += x_taps.weights[t] * (float)row[x_taps.index[t]];
+			filtered[x] = sum;
+		}
+	}
+
+	std::fill(plane, plane + (size_t)target.x * target.y, 0.0f);
+	for (int y = 0; y < target.y; ++y) {
+		float* out = plane + (size_t)y * target.x;
+		for (size_t t = y_taps.first[y]; t < y_taps.first[y + 1]; ++t) {
+			const float* row = rows.data() + (size_t)y_taps.index[t] * target.x;
+			float weight = y_taps.weights[t];
+			for (int x = 0; x < target.x; ++x)
+				out[x] += weight * row[x];
+		}
+	}
+}
+
+/// <summary>
+/// Separable resampling of one voxel type. Every source slice is filtered along x and y into a float buffer of the output
+/// slice size, then every output slice is filtered from those along z, so the intermediate holds no more voxels than the
+/// source when downsampling.
+/// </summary>
+template<typename T>
+bool resampleTypedVolume(const T* values, glm::ivec3 source, glm::ivec3 target, ResampleFilter filter, T* resampled,
+	const std::function<bool(float)>& report) {
+	ResampleTaps x_taps = computeResampleTaps(source.x, target.x, filter);
+	ResampleTaps y_taps = computeResampleTaps(source.y, target.y, filter);
+	ResampleTaps z_taps = computeResampleTaps(source.z, target.z, filter);
+	size_t slice = (size_t)target.x * target.y;
+	std::vector<float> planes(slice * source.z);
+	std::atomic<size_t> done{ 0 };
+	std::atomic<bool> cancelled{ false };
+	size_t total = (size_t)source.z + target.z;
+
+	parallelFor(0, source.z, [&](size_t z_begin, size_t z_end, unsigned int) {
+		std::vector<float> rows;
+		for (size_t z = z_begin; z < z_end && !cancelled; ++z) {
+			resampleSlice(values + z * source.x * source.y, glm::ivec2(source.x, source.y), glm::ivec2(target.x, target.y), x_taps, y_taps, rows, planes.data() + z * slice);
+			if (report && !report((float)++done / total))
+				cancelled = true;
+		}
+	});
+	if (cancelled)
+		return false;
+
+	parallelFor(0, target.z, [&](size_t z_begin, size_t z_end, unsigned int) {
+		std::vector<float> sum(slice);
+		for (size_t z = z_begin; z < z_end && !cancelled; ++z) {
+			std::fill(sum.begin(), sum.end(), 0.0f);
+			for (size_t t = z_taps.first[z]; t < z_taps.first[z + 1]; ++t) {
+				const float* plane = planes.data() + (size_t)z_taps.index[t] * slice;
+				float weight = z_taps.weights[t];
+				for (size_t i = 0; i < slice; ++i)
+					sum[i] += weight * plane[i];
+			}
+			T* out = resampled + z * slice;
+			for (size_t i = 0; i < slice; ++i)
+				out[i] = resampledValue<T>(sum[i]);
+			if (report && !report((float)++done / total))
+				cancelled = true;
+		}
+	});
+	return !cancelled;
+}
+
+/// <summary>
+/// Resamples a volume to another resolution over the same physical extent. The statistics are left to be recomputed.
+/// </summary>
+/// <param name="report">Optional, called from the worker threads with the fraction done, returning false cancels the resampling.</param>
+/// <returns>Whether the volume was resampled, it is left unchanged when cancelled.</returns>
+bool resampleVolume(VOLData& data, glm::ivec3 resolution, ResampleFilter filter, const std::function<bool(float)>& report = nullptr) {
+	if (resolution == data.resolution)
+		return true;
+	if (data.values.size() < voxelCount(data) * voxelSize(data.voxel_type) || glm::any(glm::lessThan(resolution, glm::ivec3(1))))
+		return false;
+
+	std::vector<unsigned char> resampled((size_t)resolution.x * resolution.y * resolution.z * voxelSize(data.voxel_type));
+	bool completed = false;
+	switch (data.voxel_type) {
+		case VoxelType::UInt8:
+			completed = resampleTypedVolume(data.values.data(), data.resolution, resolution, filter, resampled.data(), report);
+			break;
+		case VoxelType::UInt16:
+			completed = resampleTypedVolume((const unsigned short*)data.values.data(), data.resolution, resolution, filter,
+				(unsigned short*)resampled.data(), report);
+			break;
+		case VoxelType::Float32:
+			completed = resampleTypedVolume((const float*)data.values.data(), data.resolution, resolution, filter,
+				(float*)resampled.data(), report);
+			break;
+	}
+	if (!completed)
+		return false;
+
+	data.resolution = resolution;
+	data.values = std::move(resampled);
+	data.statistics = VOLStatistics();
+	return true;
+}
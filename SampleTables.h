@@ -0,0 +1,146 @@
+#pragma once
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "Parallel.h"
+
+// points of the jitter sequence, the samples of a pixel, one per progressive frame, wrap around it
+const int SAMPLE_SEQUENCE_LENGTH = 256;
+// the side of the tile of per-pixel rotations, repeated over the screen
+const int SAMPLE_SCRAMBLE_SIZE = 64;
+// the standard deviation in pixels of the energy filter the blue noise is built with, the one of the void-and-cluster method
+const float BLUE_NOISE_SIGMA = 1.5f;
+// the filter is cut off this many pixels from its centre, where it has fallen below 1e-6
+const int BLUE_NOISE_RADIUS = 8;
+
+/// <summary>
+/// The digits of an index in a base mirrored around the radix point, the van der Corput sequence.
+/// </summary>
+float radicalInverse(unsigned int index, unsigned int base) {
+	double inverse_base = 1.0 / base, digit_weight = inverse_base, result = 0.0;
+	while (index > 0) {
+		result += (index % base) * digit_weight;
+		index /= base;
+		digit_weight *= inverse_base;
+	}
+	return (float)std::min(result, 1.0 - 1e-7);
+}
+
+/// <summary>
+/// The Halton sequence in bases 2, 3 and 5: the offset of a sample within its pixel in xy, and of the first sample along its ray,
+/// in steps, in z. Every prefix of it covers the unit cube evenly, so does the average of the first few samples of a pixel.
+/// </summary>
+std::vector<glm::vec4> buildSampleSequence(int length = SAMPLE_SEQUENCE_LENGTH) {
+	std::vector<glm::vec4> sequence(length);
+	for (int i = 0; i < length; ++i)
+		sequence[i] = glm::vec4(radicalInverse(i, 2), radicalInverse(i, 3), radicalInverse(i, 5), 0.0f);
+	return sequence;
+}
+
+/// <summary>
+/// A tileable blue noise of values evenly spread over [0, 1) by the void-and-cluster method: points are ranked by repeatedly
+/// taking out the tightest cluster and filling in the largest void, as measured by a Gaussian energy filter that wraps around the tile.
+/// Neighbouring pixels get values far apart, so the noise they scramble the samples with has no low frequencies.
+/// </summary>
+/// <param name="seed">Seeds the initial pattern, different seeds give uncorrelated noise.</param>
+std::vector<float> buildBlueNoise(int size, unsigned int seed) {
+	int count = size * size;
+	// the filter by the offset between two pixels, within the radius and the tile
+	int radius = std::min(BLUE_NOISE_RADIUS, (size - 1) / 2), side = 2 * radius + 1;
+	std::vector<float> filter(side * side);
+	for (int dy = -radius; dy <= radius; ++dy) {
+		for (int dx = -radius; dx <= radius; ++dx)
+			filter[(dy + radius) * side + dx + radius] = std::exp(-(dx * dx + dy * dy) / (2.0f * BLUE_NOISE_SIGMA * BLUE_NOISE_SIGMA));
+	}
+
+	std::vector<char> pattern(count, 0);
+	std::vector<float> energy(count, 0.0f);
+	auto toggle = [&](int pixel, bool set) {
+		pattern[pixel] = set;
+		int px = pixel % size, py = pixel / size;
+		float sign = set ? 1.0f : -1.0f;
+		for (int dy = -radius; dy <= radius; ++dy) {
+			float* row = &energy[((py + dy + size) % size) * size];
+			const float* filter_row = &filter[(dy + radius) * side + radius];
+			for (int dx = -radius; dx <= radius; ++dx)
+				row[(px + dx + size) % size] += sign * filter_row[dx];
+		}
+	};
+	auto tightestCluster = [&]() {
+		int best = -1;
+		for (int i = 0; i < count; ++i) {
+			if (pattern[i] && (best < 0 || energy[i] > energy[best]))
+				best = i;
+		}
+		return best;
+	};
+	auto largestVoid = [&]() {
+		int best = -1;
+		for (int i = 0; i < count; ++i) {
+			if (!pattern[i] && (best < 0 || energy[i] < energy[best]))
+				best = i;
+		}
+		return best;
+	};
+
+	// a random tenth of the pixels, spread out by moving the tightest cluster into the largest void until it stays
+	std::mt19937 random(seed);
+	int initial_count = std::max(count / 10, 1);
+	for (int placed = 0; placed < initial_count;) {
+		int pixel = (int)(random() % count);
+		if (!pattern[pixel]) {
+			toggle(pixel, true);
+			++placed;
+		}
+	}
+	for (int swaps = 0; swaps < count; ++swaps) {
+		int cluster = tightestCluster();
+		toggle(cluster, false);
+		int fill = largestVoid();
+		toggle(fill, true);
+		if (fill == cluster)
+			break;
+	}
+
+	// the initial points are ranked below it by taking them out, the rest above it by filling in around them
+	std::vector<int> rank(count);
+	std::vector<char> initial_pattern = pattern;
+	std::vector<float> initial_energy = energy;
+	for (int r = initial_count - 1; r >= 0; --r) {
+		int cluster = tightestCluster();
+		toggle(cluster, false);
+		rank[cluster] = r;
+	}
+	pattern = initial_pattern;
+	energy = initial_energy;
+	for (int r = initial_count; r < count; ++r) {
+		int fill = largestVoid();
+		toggle(fill, true);
+		rank[fill] = r;
+	}
+
+	std::vector<float> noise(count);
+	for (int i = 0; i < count; ++i)
+		noise[i] = (rank[i] + 0.5f) / count;
+	return noise;
+}
+
+/// <summary>
+/// The per-pixel rotations of the sample sequence, a Cranley-Patterson rotation per pixel of the tile, one independent blue noise
+/// per dimension of the sequence. Rotated points keep their even spread within a pixel, and neighbouring pixels take different ones.
+/// </summary>
+std::vector<glm::vec4> buildSampleScramble(int size = SAMPLE_SCRAMBLE_SIZE) {
+	std::vector<std::vector<float>> channels(3);
+	parallelFor(0, channels.size(), [&](size_t begin, size_t end, unsigned int) {
+		for (size_t channel = begin; channel < end; ++channel)
+			channels[channel] = buildBlueNoise(size, 1 + (unsigned int)channel);
+	});
+	std::vector<glm::vec4> scramble((size_t)size * size);
+	for (size_t i = 0; i < scramble.size(); ++i)
+		scramble[i] = glm::vec4(channels[0][i], channels[1][i], channels[2][i], 0.0f);
+	return scramble;
+}
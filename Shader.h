@@ -6,8 +6,14 @@
 #include <fstream>
 #include <sstream>
 #include <vector>
+#include <map>
+#include <string>
+#include <utility>
 #include <cstdlib>
 
+// the preprocessor definitions, names and values, a variant of a shader is compiled with
+typedef std::vector<std::pair<std::string, std::string>> ShaderDefines;
+
 
 
 
@@ -41,15 +47,35 @@ bool generateShader(GLuint& shader, std::string shader_type) {
 	return true;
 }
 
-GLuint loadFromFile(const char* shader_file_path, const char* shader_type) {
-	GLuint shader;
-	std::string stype(shader_type);
-	if (!generateShader(shader, stype))
-		return 0;
+/// <summary>
+/// Inserts #define lines into shader source after its #version line, which has to come first.
+/// </summary>
+std::string defineShaderVariant(const std::string& shader_code, const ShaderDefines& defines) {
+	if (defines.empty())
+		return shader_code;
+	std::string define_lines;
+	for (const auto& define : defines)
+		define_lines += "#define " + define.first + " " + define.second + "\n";
+	size_t version = shader_code.find("#version");
+	size_t line_end = version == std::string::npos ? std::string::npos : shader_code.find('\n', version);
+	if (line_end == std::string::npos)
+		return define_lines + shader_code;
+	return shader_code.substr(0, line_end + 1) + define_lines + shader_code.substr(line_end + 1);
+}
+
+/// <summary>
+/// The key a shader variant is cached under, its definitions in order.
+/// </summary>
+std::string shaderVariantKey(const ShaderDefines& defines) {
+	std::string key;
+	for (const auto& define : defines)
+		key += (key.empty() ? "" : " ") + define.first + "=" + define.second;
+	return key.empty() ? "general" : key;
+}
 
+bool readShaderFile(const char* shader_file_path, std::string& shader_code) {
 	std::ifstream shader_fstream;
 	shader_fstream.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-	std::string shader_code;
 	try {
 		shader_fstream.open(shader_file_path);
 		std::stringstream shader_sstream;
@@ -59,8 +85,20 @@ GLuint loadFromFile(const char* shader_file_path, const char* shader_type) {
 	}
 	catch (std::ifstream::failure e) {
 		std::cerr << "[ERROR] Could not read shader file." << std::endl;
-		return 0;
+		return false;
 	}
+	return true;
+}
+
+GLuint loadFromFile(const char* shader_file_path, const char* shader_type) {
+	GLuint shader;
+	std::string stype(shader_type);
+	if (!generateShader(shader, stype))
+		return 0;
+
+	std::string shader_code;
+	if (!readShaderFile(shader_file_path, shader_code))
+		return 0;
 
 	const char* shader_cstr = shader_code.c_str();
 	// lets source the shader
@@ -143,6 +181,125 @@ class ComputeProgram : public Program {
 		}
 };
 
+/// <summary>
+/// The variants of a compute shader specialized by #defines, compiled the first time each is asked for and cached by their definitions.
+/// A variant only has the uniforms its definitions leave in use, so the uniforms are all set on a general program,
+/// compiled without definitions, and copied over from it before a variant is dispatched.
+/// </summary>
+class ComputeVariants {
+	public:
+		bool load(const char* compute_shader_path) {
+			return readShaderFile(compute_shader_path, shader_code);
+		}
+
+		const std::string& source() const {
+			return shader_code;
+		}
+
+		/// <summary>
+		/// Sets the definitions every variant is compiled with ahead of its own, dropping the variants compiled with the previous ones.
+		/// </summary>
+		void setBaseDefines(const ShaderDefines& defines) {
+			clear();
+			base_defines = defines;
+		}
+
+		/// <summary>
+		/// The program of a variant, compiled if it is not cached yet.
+		/// </summary>
+		/// <returns>The program, or 0 if the variant does not compile, which is not retried.</returns>
+		GLuint get(const ShaderDefines& defines) {
+			std::string key = shaderVariantKey(defines);
+			auto cached = programs.find(key);
+			if (cached != programs.end())
+				return cached->second;
+
+			ComputeProgram variant;
+			std::cout << "Compiling the compute shader variant " << key << std::endl;
+			ShaderDefines all_defines = base_defines;
+			all_defines.insert(all_defines.end(), defines.begin(), defines.end());
+			GLuint program = variant.generateProgramFromText(defineShaderVariant(shader_code, all_defines)) ? variant.program : 0;
+			if (program == 0 && variant.program != 0)
+				glDeleteProgram(variant.program);
+			programs[key] = program;
+			return program;
+		}
+
+		/// <summary>
+		/// Sets the uniforms of a variant to those of the general program, except the samplers and images whose bindings are in the source.
+		/// </summary>
+		void copyUniforms(GLuint general_program, GLuint variant_program) {
+			if (general_program == variant_program)
+				return;
+			auto mapping = uniform_mappings.find({ general_program, variant_program });
+			if (mapping == uniform_mappings.end())
+				mapping = uniform_mappings.emplace(std::make_pair(general_program, variant_program), mapUniforms(general_program, variant_program)).first;
+
+			glUseProgram(variant_program);
+			for (const UniformCopy& uniform : mapping->second) {
+				GLfloat floats[16];
+				GLint ints[4];
+				switch (uniform.type) {
+					case GL_FLOAT: glGetUniformfv(general_program, uniform.from, floats); glUniform1fv(uniform.to, 1, floats); break;
+					case GL_FLOAT_VEC2: glGetUniformfv(general_program, uniform.from, floats); glUniform2fv(uniform.to, 1, floats); break;
+					case GL_FLOAT_VEC3: glGetUniformfv(general_program, uniform.from, floats); glUniform3fv(uniform.to, 1, floats); break;
+					case GL_FLOAT_VEC4: glGetUniformfv(general_program, uniform.from, floats); glUniform4fv(uniform.to, 1, floats); break;
+					case GL_FLOAT_MAT4: glGetUniformfv(general_program, uniform.from, floats); glUniformMatrix4fv(uniform.to, 1, GL_FALSE, floats); break;
+					case GL_INT: case GL_BOOL: glGetUniformiv(general_program, uniform.from, ints); glUniform1iv(uniform.to, 1, ints); break;
+					case GL_INT_VEC2: glGetUniformiv(general_program, uniform.from, ints); glUniform2iv(uniform.to, 1, ints); break;
+					case GL_INT_VEC3: glGetUniformiv(general_program, uniform.from, ints); glUniform3iv(uniform.to, 1, ints); break;
+					case GL_INT_VEC4: glGetUniformiv(general_program, uniform.from, ints); glUniform4iv(uniform.to, 1, ints); break;
+				}
+			}
+		}
+
+		size_t compiledCount() const {
+			size_t count = 0;
+			for (const auto& program : programs)
+				count += program.second != 0;
+			return count;
+		}
+
+		void clear() {
+			for (const auto& program : programs) {
+				if (program.second != 0)
+					glDeleteProgram(program.second);
+			}
+			programs.clear();
+			uniform_mappings.clear();
+		}
+
+	private:
+		struct UniformCopy {
+			GLint from, to;
+			GLenum type;
+		};
+
+		std::string shader_code;
+		ShaderDefines base_defines;
+		std::map<std::string, GLuint> programs;
+		std::map<std::pair<GLuint, GLuint>, std::vector<UniformCopy>> uniform_mappings;
+
+		// the uniforms of the variant by their locations in both programs, only single values of the types copyUniforms knows
+		static std::vector<UniformCopy> mapUniforms(GLuint general_program, GLuint variant_program) {
+			std::vector<UniformCopy> mapping;
+			GLint uniform_count = 0;
+			glGetProgramiv(variant_program, GL_ACTIVE_UNIFORMS, &uniform_count);
+			for (GLint i = 0; i < uniform_count; ++i) {
+				char name[256];
+				GLint size;
+				GLenum type;
+				glGetActiveUniform(variant_program, (GLuint)i, sizeof(name), NULL, &size, &type, name);
+				bool copied = type == GL_FLOAT || type == GL_FLOAT_VEC2 || type == GL_FLOAT_VEC3 || type == GL_FLOAT_VEC4 || type == GL_FLOAT_MAT4 ||
+					type == GL_INT || type == GL_BOOL || type == GL_INT_VEC2 || type == GL_INT_VEC3 || type == GL_INT_VEC4;
+				GLint from = glGetUniformLocation(general_program, name), to = glGetUniformLocation(variant_program, name);
+				if (copied && size == 1 && from >= 0 && to >= 0)
+					mapping.push_back(UniformCopy{ from, to, type });
+			}
+			return mapping;
+		}
+};
+
 class RenderProgram : public Program {
 	public:
 		RenderProgram() {}
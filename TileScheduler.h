@@ -0,0 +1,203 @@
+#pragma once
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+// the side of a screen tile in pixels, rounded up to whole work groups
+const int TILE_SIZE = 128;
+
+/// <summary>
+/// Splits raytracing a frame into screen tiles and dispatches only as many of them per frame as fit a GPU time budget,
+/// so a frame that takes longer than that is spread over several and the UI stays responsive meanwhile.
+/// Every dispatch is timed between two GPU timestamp queries, read back without stalling once they are available.
+/// Timestamps rather than GL_TIME_ELAPSED, as some drivers report no elapsed time for compute dispatches.
+/// Tiles are traced from the centre of the screen out, as a partially updated image is presented in between.
+/// </summary>
+class TileScheduler {
+	public:
+		// the GPU time to spend raytracing per frame, in milliseconds
+		float budget_ms = 10.0f;
+
+		/// <summary>
+		/// Starts a pass over an image, the tiles keep their measured times as long as its size stays the same.
+		/// </summary>
+		void beginPass(glm::ivec2 size, const std::vector<GLint>& work_group_size) {
+			if (size != pass_size || work_group_size[0] != group_size.x || work_group_size[1] != group_size.y) {
+				pass_size = size;
+				group_size = glm::ivec2(work_group_size[0], work_group_size[1]);
+				buildTiles();
+			}
+			next_tile = 0;
+			pass_active = true;
+		}
+
+		/// <summary>
+		/// Abandons the pass in progress, the next one starts from the first tile again.
+		/// </summary>
+		void restart() {
+			pass_active = false;
+			next_tile = 0;
+		}
+
+		bool passActive() const {
+			return pass_active;
+		}
+
+		glm::ivec2 passSize() const {
+			return pass_size;
+		}
+
+		/// <summary>
+		/// Dispatches the next tiles of the pass that fit the budget, at least one. The uniforms other than the tile offset are left as they are.
+		/// </summary>
+		/// <returns>Whether the pass is complete.</returns>
+		bool dispatch(GLuint compute_program) {
+			collect();
+			GLint offset_location = glGetUniformLocation(compute_program, "u_tile_offset");
+			float planned_ms = 0.0f;
+			bool first = true;
+			while (next_tile < (int)tiles.size()) {
+				Tile& tile = tiles[next_tile];
+				// a tile that was never timed is given the whole budget until the first results come in
+				float cost = estimate(tile);
+				if (cost < 0.0f)
+					cost = budget_ms;
+				if (!first && planned_ms + cost > budget_ms)
+					break;
+				planned_ms += cost;
+				first = false;
+
+				PendingQuery query{ takeQuery(), takeQuery(), next_tile, (float)tile.size.x * tile.size.y, tile_generation };
+				glUniform2iv(offset_location, 1, &tile.offset.x);
+				glQueryCounter(query.start, GL_TIMESTAMP);
+				glDispatchCompute((tile.size.x + group_size.x - 1) / group_size.x, (tile.size.y + group_size.y - 1) / group_size.y, 1);
+				glQueryCounter(query.end, GL_TIMESTAMP);
+				pending.push_back(query);
+				++next_tile;
+			}
+			glUniform2i(offset_location, 0, 0);
+			if (next_tile < (int)tiles.size())
+				return false;
+			pass_active = false;
+			return true;
+		}
+
+		/// <summary>
+		/// The GPU time a whole pass is estimated to take from the latest measurements, 0 until there are any.
+		/// </summary>
+		float passMilliseconds() const {
+			if (milliseconds_per_pixel < 0.0f)
+				return 0.0f;
+			float sum = 0.0f;
+			for (const Tile& tile : tiles)
+				sum += estimate(tile);
+			return sum;
+		}
+
+		int tileCount() const {
+			return (int)tiles.size();
+		}
+
+		int tilesDone() const {
+			return pass_active ? next_tile : (int)tiles.size();
+		}
+
+		void clear() {
+			for (const PendingQuery& query : pending) {
+				free_queries.push_back(query.start);
+				free_queries.push_back(query.end);
+			}
+			pending.clear();
+			if (!free_queries.empty())
+				glDeleteQueries((GLsizei)free_queries.size(), free_queries.data());
+			free_queries.clear();
+		}
+
+	private:
+		struct Tile {
+			glm::ivec2 offset, size;
+			// the GPU time of the last dispatch of the tile, negative if it was never timed
+			float milliseconds = -1.0f;
+		};
+		struct PendingQuery {
+			GLuint start, end;
+			int tile;
+			float pixels;
+			// queries issued for tiles of an earlier size are only used for the average
+			unsigned int generation;
+		};
+
+		glm::ivec2 pass_size = glm::ivec2(0), group_size = glm::ivec2(1);
+		std::vector<Tile> tiles;
+		unsigned int tile_generation = 0;
+		int next_tile = 0;
+		bool pass_active = false;
+		// a running average over every timed tile for the tiles not timed yet, negative before the first
+		float milliseconds_per_pixel = -1.0f;
+		std::deque<PendingQuery> pending;
+		std::vector<GLuint> free_queries;
+
+		void buildTiles() {
+			tiles.clear();
+			++tile_generation;
+			glm::ivec2 tile_size = ((glm::ivec2(TILE_SIZE) + group_size - 1) / group_size) * group_size;
+			for (int y = 0; y < pass_size.y; y += tile_size.y) {
+				for (int x = 0; x < pass_size.x; x += tile_size.x) {
+					Tile tile;
+					tile.offset = glm::ivec2(x, y);
+					tile.size = glm::min(tile_size, pass_size - tile.offset);
+					tiles.push_back(tile);
+				}
+			}
+			// the middle of the image is what is looked at, it is updated first
+			glm::vec2 centre = glm::vec2(pass_size) * 0.5f;
+			auto distance = [&](const Tile& tile) {
+				glm::vec2 offset = glm::vec2(tile.offset) + glm::vec2(tile.size) * 0.5f - centre;
+				return glm::dot(offset, offset);
+			};
+			std::stable_sort(tiles.begin(), tiles.end(), [&](const Tile& a, const Tile& b) { return distance(a) < distance(b); });
+		}
+
+		float estimate(const Tile& tile) const {
+			if (tile.milliseconds >= 0.0f || milliseconds_per_pixel < 0.0f)
+				return tile.milliseconds;
+			return milliseconds_per_pixel * tile.size.x * tile.size.y;
+		}
+
+		GLuint takeQuery() {
+			if (free_queries.empty()) {
+				GLuint query;
+				glGenQueries(1, &query);
+				return query;
+			}
+			GLuint query = free_queries.back();
+			free_queries.pop_back();
+			return query;
+		}
+
+		// reads back the timestamps of the tiles that have finished, they finish in order
+		void collect() {
+			while (!pending.empty()) {
+				PendingQuery& query = pending.front();
+				GLint available = GL_FALSE;
+				glGetQueryObjectiv(query.end, GL_QUERY_RESULT_AVAILABLE, &available);
+				if (!available)
+					break;
+				GLuint64 start = 0, end = 0;
+				glGetQueryObjectui64v(query.start, GL_QUERY_RESULT, &start);
+				glGetQueryObjectui64v(query.end, GL_QUERY_RESULT, &end);
+				float milliseconds = (float)((end - start) * 1e-6);
+				if (query.generation == tile_generation)
+					tiles[query.tile].milliseconds = milliseconds;
+				float pixel_milliseconds = milliseconds / query.pixels;
+				milliseconds_per_pixel = milliseconds_per_pixel < 0.0f ? pixel_milliseconds : 0.8f * milliseconds_per_pixel + 0.2f * pixel_milliseconds;
+				free_queries.push_back(query.start);
+				free_queries.push_back(query.end);
+				pending.pop_front();
+			}
+		}
+};
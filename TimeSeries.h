@@ -0,0 +1,326 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "VOLParser.h"
+#include "VOLStatistics.h"
+
+/// <summary>
+/// Finds the numbered series a VOL file belongs to, e.g. scan_007.vol belongs to scan_000.vol, scan_001.vol, ...
+/// The series is every file in the same directory with the same name around the last run of digits.
+/// </summary>
+/// <returns>The files of the series ordered by their number, empty if the file name has no number.</returns>
+std::vector<std::string> discoverVOLSeries(const std::string& VOL_filepath) {
+	std::filesystem::path path(VOL_filepath);
+	std::string stem = path.stem().string();
+	size_t digits_end = stem.find_last_of("0123456789");
+	if (digits_end == std::string::npos)
+		return {};
+	size_t digits_begin = stem.find_last_not_of("0123456789", digits_end);
+	digits_begin = digits_begin == std::string::npos ? 0 : digits_begin + 1;
+	std::string prefix = stem.substr(0, digits_begin), suffix = stem.substr(digits_end + 1) + path.extension().string();
+
+	std::map<long long, std::string> numbered;
+	std::error_code error;
+	std::filesystem::path directory = path.has_parent_path() ? path.parent_path() : std::filesystem::path(".");
+	for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(directory, error)) {
+		std::string name = entry.path().filename().string();
+		if (name.size() <= prefix.size() + suffix.size() || name.compare(0, prefix.size(), prefix) != 0 ||
+			name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0)
+			continue;
+		std::string number = name.substr(prefix.size(), name.size() - prefix.size() - suffix.size());
+		if (number.find_first_not_of("0123456789") != std::string::npos || number.size() > 18)
+			continue;
+		numbered[std::stoll(number)] = path.has_parent_path() ? entry.path().string() : name;
+	}
+
+	std::vector<std::string> series;
+	for (auto& [number, name] : numbered)
+		series.push_back(name);
+	return series;
+}
+
+/// <summary>
+/// Plays a numbered series of VOL files (one per timestep) as one dataset. Worker threads decode a ring of timesteps
+/// ahead of the playhead, the render thread calls update() every frame and uploads the timestep it hands over.
+/// When a timestep is not decoded in time playback holds the current one (prefetch lag), when rendering falls behind
+/// the target rate timesteps are skipped (dropped frames).
+/// </summary>
+class TimeSeriesPlayer {
+	public:
+		// how many timesteps are decoded ahead of the playhead, ring_size and loop are read by the workers, set them before open()
+		int ring_size = 4;
+		bool loop = true;
+		float frames_per_second = 10.0f;
+
+		TimeSeriesPlayer(unsigned int decode_threads = 2) {
+			for (unsigned int i = 0; i < decode_threads; ++i)
+				workers.emplace_back(&TimeSeriesPlayer::run, this);
+		}
+
+		TimeSeriesPlayer(const TimeSeriesPlayer&) = delete;
+		TimeSeriesPlayer& operator=(const TimeSeriesPlayer&) = delete;
+
+		~TimeSeriesPlayer() {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			wake.notify_all();
+			for (std::thread& worker : workers)
+				worker.join();
+		}
+
+		/// <summary>
+		/// Replaces the series being played, starting paused at its first timestep.
+		/// </summary>
+		void open(std::vector<std::string> VOL_filepaths) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				frames = std::move(VOL_filepaths);
+				ring.clear();
+				decoding.clear();
+				++series_generation;
+				playhead = 0;
+				shown = -1;
+				playing = false;
+				dropped_frames = 0;
+				prefetch_lag = 0;
+			}
+			wake.notify_all();
+		}
+
+		void close() {
+			open({});
+		}
+
+		bool active() {
+			std::lock_guard<std::mutex> lock(mutex);
+			return !frames.empty();
+		}
+
+		void play() {
+			std::lock_guard<std::mutex> lock(mutex);
+			playing = true;
+			clock_start = std::chrono::steady_clock::now();
+			clock_frame = playhead;
+		}
+
+		void pause() {
+			std::lock_guard<std::mutex> lock(mutex);
+			playing = false;
+		}
+
+		bool isPlaying() {
+			std::lock_guard<std::mutex> lock(mutex);
+			return playing;
+		}
+
+		/// <summary>
+		/// Whether update() still has a timestep to hand over, while playing or after a seek to one not yet decoded.
+		/// </summary>
+		bool pending() {
+			std::lock_guard<std::mutex> lock(mutex);
+			return !frames.empty() && (playing || shown != playhead);
+		}
+
+		/// <summary>
+		/// Moves the playhead, the timestep is handed over by update() once it is decoded.
+		/// </summary>
+		void seek(int frame) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (frames.empty())
+					return;
+				playhead = std::clamp(frame, 0, (int)frames.size() - 1);
+				clock_start = std::chrono::steady_clock::now();
+				clock_frame = playhead;
+				dropStale();
+			}
+			wake.notify_all();
+		}
+
+		/// <summary>
+		/// Advances the playhead by the time passed and hands over its timestep if it changed and is decoded.
+		/// </summary>
+		/// <param name="data">Receives the timestep to show.</param>
+		/// <returns>Whether a new timestep was handed over.</returns>
+		bool update(VOLData& data) {
+			std::unique_lock<std::mutex> lock(mutex);
+			if (frames.empty())
+				return false;
+
+			int frame_count = (int)frames.size();
+			if (playing) {
+				double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - clock_start).count();
+				int due = clock_frame + (int)(elapsed * frames_per_second);
+				if (due >= frame_count) {
+					if (loop) {
+						due %= frame_count;
+						clock_start = std::chrono::steady_clock::now();
+						clock_frame = due;
+					}
+					else {
+						due = frame_count - 1;
+						playing = false;
+					}
+				}
+				if (due != playhead) {
+					// timesteps passed over between two rendered frames were never shown
+					int advanced = (due - playhead + frame_count) % frame_count;
+					if (shown == playhead && advanced > 1)
+						dropped_frames += advanced - 1;
+					playhead = due;
+					dropStale();
+					wake.notify_all();
+				}
+			}
+
+			if (playhead == shown)
+				return false;
+			auto decoded = ring.find(playhead);
+			if (decoded == ring.end()) {
+				if (playing) {
+					// hold the current timestep and restart the clock from the one we are waiting for
+					++prefetch_lag;
+					clock_start = std::chrono::steady_clock::now();
+					clock_frame = playhead;
+				}
+				return false;
+			}
+			data = decoded->second;
+			shown = playhead;
+			return true;
+		}
+
+		int frameCount() {
+			std::lock_guard<std::mutex> lock(mutex);
+			return (int)frames.size();
+		}
+
+		int currentFrame() {
+			std::lock_guard<std::mutex> lock(mutex);
+			return playhead;
+		}
+
+		/// <summary>
+		/// How many of the ring_size timesteps ahead of the playhead are decoded.
+		/// </summary>
+		int ringFill() {
+			std::lock_guard<std::mutex> lock(mutex);
+			return (int)ring.size();
+		}
+
+		unsigned long long droppedFrames() const {
+			return dropped_frames;
+		}
+
+		unsigned long long prefetchLag() const {
+			return prefetch_lag;
+		}
+
+	private:
+		std::vector<std::thread> workers;
+		std::mutex mutex;
+		std::condition_variable wake;
+		bool stopping = false;
+
+		std::vector<std::string> frames;
+		unsigned int series_generation = 0;
+		// decoded timesteps by index, and the ones a worker is decoding
+		std::map<int, VOLData> ring;
+		std::vector<int> decoding;
+
+		int playhead = 0, shown = -1;
+		bool playing = false;
+		std::chrono::steady_clock::time_point clock_start;
+		int clock_frame = 0;
+
+		std::atomic<unsigned long long> dropped_frames{ 0 };
+		std::atomic<unsigned long long> prefetch_lag{ 0 };
+
+		// the distance of a timestep ahead of the playhead, wrapping around when looping
+		int distanceAhead(int frame) const {
+			int frame_count = (int)frames.size();
+			int distance = frame - playhead;
+			if (loop && distance < 0)
+				distance += frame_count;
+			return distance;
+		}
+
+		bool inRing(int frame) const {
+			int distance = distanceAhead(frame);
+			return distance >= 0 && distance < ring_size;
+		}
+
+		// frees the timesteps that fell out of the ring, must hold the mutex
+		void dropStale() {
+			for (auto it = ring.begin(); it != ring.end();) {
+				if (inRing(it->first))
+					++it;
+				else
+					it = ring.erase(it);
+			}
+		}
+
+		// the timestep closest ahead of the playhead that is neither decoded nor being decoded, -1 if there is none
+		int nextToDecode() const {
+			int frame_count = (int)frames.size();
+			for (int distance = 0; distance < std::min(ring_size, frame_count); ++distance) {
+				int frame = playhead + distance;
+				if (frame >= frame_count) {
+					if (!loop)
+						break;
+					frame -= frame_count;
+				}
+				if (!ring.count(frame) && std::find(decoding.begin(), decoding.end(), frame) == decoding.end())
+					return frame;
+			}
+			return -1;
+		}
+
+		void run() {
+			while (true) {
+				int frame;
+				std::string VOL_filepath;
+				unsigned int generation;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					wake.wait(lock, [&]() { return stopping || (!frames.empty() && nextToDecode() >= 0); });
+					if (stopping)
+						return;
+					frame = nextToDecode();
+					decoding.push_back(frame);
+					VOL_filepath = frames[frame];
+					generation = series_generation;
+				}
+
+				VOLData data = parseVOLDataFromMappedFile(VOL_filepath.c_str());
+				// the statistics pass faults the whole mapping in here rather than during the upload
+				if (data.name != "Placeholder")
+					computeVOLStatistics(data);
+
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					if (generation != series_generation)
+						continue;
+					decoding.erase(std::find(decoding.begin(), decoding.end(), frame));
+					// a timestep that failed to decode shows as the placeholder rather than stalling playback
+					if (data.name == "Placeholder")
+						std::cerr << "[ERROR] Could not decode timestep " << frame << ": " << VOL_filepath << std::endl;
+					if (inRing(frame))
+						ring[frame] = std::move(data);
+				}
+				wake.notify_all();
+			}
+		}
+};
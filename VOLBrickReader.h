@@ -0,0 +1,215 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "VOLParser.h"
+#include "Parallel.h"
+
+/// <summary>
+/// A brick of voxels handed out by VOLBrickReader. values covers the interior plus ghost voxels on every side in native
+/// byte order, ghost voxels outside of the volume repeat the nearest voxel on the border.
+/// </summary>
+struct VOLBrick {
+	glm::ivec3 index;  // position in the grid of bricks
+	glm::ivec3 origin; // voxel coordinates of the first interior voxel
+	glm::ivec3 size;   // interior size, smaller than the brick size at the far edges of the volume
+	int ghost = 0;
+	VoxelType voxel_type = VoxelType::UInt8;
+	std::vector<unsigned char> values;
+
+	glm::ivec3 dataSize() const {
+		return size + 2 * ghost;
+	}
+
+	/// <summary>
+	/// The voxel at interior coordinates (x, y, z), each of which may reach into the ghost voxels down to -ghost.
+	/// T has to match the voxel type.
+	/// </summary>
+	template <typename T = unsigned char>
+	const T& at(int x, int y, int z) const {
+		glm::ivec3 data_size = dataSize();
+		size_t index = ((size_t)(z + ghost) * data_size.y + (y + ghost)) * data_size.x + (x + ghost);
+		return ((const T*)values.data())[index];
+	}
+};
+
+/// <summary>
+/// Streams a VOL file brick by brick in bounded memory, for volumes that do not fit into RAM.
+/// The file is read one strip of bricks at a time (a row of bricks along x), while the strip after it is prefetched.
+/// At most two strips of (brick.y + 2 ghost) * (brick.z + 2 ghost) * resolution.x voxels are held at once.
+/// Multi-byte voxels are converted to native byte order as they are read.
+/// </summary>
+class VOLBrickReader {
+	public:
+		VOLData header;
+		glm::ivec3 brick_size = glm::ivec3(64);
+		int ghost = 1;
+
+		VOLBrickReader() {}
+
+		/// <summary>
+		/// Opens the file and parses its header, no voxels are read yet.
+		/// </summary>
+		bool open(const char* VOL_filepath) {
+			file_path = VOL_filepath;
+			std::error_code error;
+			size_t file_size = std::filesystem::file_size(file_path, error);
+			std::ifstream VOL_fstream(VOL_filepath, std::ios::binary);
+			unsigned char header_bytes[VOL_HEADER_SIZE];
+			if (error || !VOL_fstream.read((char*)header_bytes, VOL_HEADER_SIZE))
+				return false;
+
+			header = VOLData();
+			header.name = file_path.substr(0, file_path.find_last_of("."));
+			// parseVOLHeader only reads the header bytes, the file size is passed to check the voxels are all there
+			if (!parseVOLHeader(header_bytes, file_size, header)) {
+				std::cerr << "[ERROR] VOL File is truncated or has an invalid header: " << file_path << std::endl;
+				return false;
+			}
+			return true;
+		}
+
+		glm::ivec3 brickCount() const {
+			return (header.resolution + brick_size - 1) / brick_size;
+		}
+
+		/// <summary>
+		/// The most voxel memory held at once while streaming, in bytes.
+		/// </summary>
+		size_t peakMemory() const {
+			return 2 * stripSize();
+		}
+
+		/// <summary>
+		/// Calls visit once for every brick of the volume. The bricks of a strip are visited in parallel,
+		/// so visit has to be thread safe, it receives the index of the thread it runs on.
+		/// </summary>
+		/// <param name="visit">Called as visit(brick, thread_index), returning false stops the iteration.</param>
+		/// <returns>False if the file could not be read or visit stopped the iteration early.</returns>
+		bool forEachBrick(const std::function<bool(const VOLBrick&, unsigned int)>& visit) {
+			std::ifstream VOL_fstream(file_path, std::ios::binary);
+			if (!VOL_fstream)
+				return false;
+
+			glm::ivec3 count = brickCount();
+			int strips = count.y * count.z;
+			std::vector<unsigned char> current(stripSize()), next(stripSize());
+
+			std::future<bool> prefetch = std::async(std::launch::async, &VOLBrickReader::readStrip, this, std::ref(VOL_fstream), 0, std::ref(next));
+			for (int strip = 0; strip < strips; ++strip) {
+				if (!prefetch.get())
+					return false;
+				std::swap(current, next);
+				if (strip + 1 < strips)
+					prefetch = std::async(std::launch::async, &VOLBrickReader::readStrip, this, std::ref(VOL_fstream), strip + 1, std::ref(next));
+
+				std::atomic<bool> stopped{ false };
+				glm::ivec3 strip_index(0, strip % count.y, strip / count.y);
+				parallelFor(0, count.x, [&](size_t x_begin, size_t x_end, unsigned int thread_index) {
+					VOLBrick brick;
+					for (size_t bx = x_begin; bx < x_end && !stopped; ++bx) {
+						cutBrick(current, glm::ivec3((int)bx, strip_index.y, strip_index.z), brick);
+						if (!visit(brick, thread_index))
+							stopped = true;
+					}
+				});
+				if (stopped) {
+					if (strip + 1 < strips)
+						prefetch.wait();
+					return false;
+				}
+			}
+			return true;
+		}
+
+	private:
+		std::string file_path;
+
+		// a strip spans the full width of the volume and one brick plus ghost voxels in y and z
+		glm::ivec3 stripDimensions() const {
+			return glm::ivec3(header.resolution.x, brick_size.y + 2 * ghost, brick_size.z + 2 * ghost);
+		}
+
+		size_t stripSize() const {
+			glm::ivec3 dims = stripDimensions();
+			return (size_t)dims.x * dims.y * dims.z * voxelSize(header.voxel_type);
+		}
+
+		/// <summary>
+		/// Reads the strip of bricks at (strip % count.y, strip / count.y) including ghost rows and slices,
+		/// clamping rows and slices outside of the volume to the border.
+		/// </summary>
+		bool readStrip(std::ifstream& VOL_fstream, int strip, std::vector<unsigned char>& buffer) {
+			glm::ivec3 count = brickCount();
+			glm::ivec3 dims = stripDimensions();
+			glm::ivec3 resolution = header.resolution;
+			int y_begin = (strip % count.y) * brick_size.y - ghost;
+			int z_begin = (strip / count.y) * brick_size.z - ghost;
+			size_t value_size = voxelSize(header.voxel_type);
+			size_t row_length = (size_t)resolution.x * value_size;
+
+			for (int dz = 0; dz < dims.z; ++dz) {
+				int z = glm::clamp(z_begin + dz, 0, resolution.z - 1);
+				// the rows inside the volume are contiguous in the file, read them in one go
+				int y_first = glm::clamp(y_begin, 0, resolution.y - 1);
+				int y_last = glm::clamp(y_begin + dims.y - 1, 0, resolution.y - 1);
+				size_t dy_first = (size_t)(y_first - y_begin);
+				unsigned char* slice = buffer.data() + (size_t)dz * dims.y * row_length;
+				std::streamoff offset = (std::streamoff)VOL_HEADER_SIZE + ((std::streamoff)z * resolution.y + y_first) * (std::streamoff)row_length;
+				VOL_fstream.seekg(offset);
+				unsigned char* rows = slice + dy_first * row_length;
+				size_t rows_size = (y_last - y_first + 1) * row_length;
+				if (!VOL_fstream.read((char*)rows, (std::streamsize)rows_size))
+					return false;
+				if (!NATIVE_BIG_ENDIAN && value_size == 2)
+					swapBytes16(rows, rows, rows_size / 2);
+				else if (!NATIVE_BIG_ENDIAN && value_size == 4)
+					swapBytes32(rows, rows, rows_size / 4);
+				// ghost rows past the border repeat the border row
+				for (size_t dy = 0; dy < dy_first; ++dy)
+					std::memcpy(slice + dy * row_length, slice + dy_first * row_length, row_length);
+				for (int dy = y_last - y_begin + 1; dy < dims.y; ++dy)
+					std::memcpy(slice + (size_t)dy * row_length, slice + (size_t)(y_last - y_begin) * row_length, row_length);
+			}
+			return true;
+		}
+
+		/// <summary>
+		/// Copies one brick with its ghost voxels out of the current strip.
+		/// </summary>
+		void cutBrick(const std::vector<unsigned char>& strip_data, glm::ivec3 index, VOLBrick& brick) const {
+			glm::ivec3 resolution = header.resolution;
+			glm::ivec3 dims = stripDimensions();
+			brick.index = index;
+			brick.origin = index * brick_size;
+			brick.size = glm::min(brick_size, resolution - brick.origin);
+			brick.ghost = ghost;
+			brick.voxel_type = header.voxel_type;
+
+			size_t value_size = voxelSize(header.voxel_type);
+			glm::ivec3 data_size = brick.dataSize();
+			brick.values.resize((size_t)data_size.x * data_size.y * data_size.z * value_size);
+			int x_begin = brick.origin.x - ghost;
+			for (int dz = 0; dz < data_size.z; ++dz) {
+				for (int dy = 0; dy < data_size.y; ++dy) {
+					const unsigned char* row = strip_data.data() + ((size_t)dz * dims.y + dy) * resolution.x * value_size;
+					unsigned char* out = brick.values.data() + ((size_t)dz * data_size.y + dy) * data_size.x * value_size;
+					// the part inside the volume is one contiguous copy, ghost voxels past the border repeat it
+					int inside_begin = std::max(0, -x_begin), inside_end = std::min(data_size.x, resolution.x - x_begin);
+					std::memcpy(out + inside_begin * value_size, row + (x_begin + inside_begin) * value_size, (inside_end - inside_begin) * value_size);
+					for (int dx = 0; dx < inside_begin; ++dx)
+						std::memcpy(out + dx * value_size, row, value_size);
+					for (int dx = inside_end; dx < data_size.x; ++dx)
+						std::memcpy(out + dx * value_size, row + (resolution.x - 1) * value_size, value_size);
+				}
+			}
+		}
+};
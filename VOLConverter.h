@@ -0,0 +1,659 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Endian.h"
+#include "Parallel.h"
+#include "Resample.h"
+#include "VOLParser.h"
+
+/// <summary>
+/// The element types scanner formats store voxels as. VOL files hold the UInt8, UInt16 and Float32 subset (VoxelType).
+/// </summary>
+enum class RawType {
+	Int8,
+	UInt8,
+	Int16,
+	UInt16,
+	Int32,
+	UInt32,
+	Float32,
+	Float64
+};
+
+size_t rawTypeSize(RawType type) {
+	switch (type) {
+		case RawType::Int8: case RawType::UInt8: return 1;
+		case RawType::Int16: case RawType::UInt16: return 2;
+		case RawType::Int32: case RawType::UInt32: case RawType::Float32: return 4;
+		case RawType::Float64: return 8;
+	}
+	return 1;
+}
+
+RawType rawTypeOf(VoxelType type) {
+	switch (type) {
+		case VoxelType::UInt8: return RawType::UInt8;
+		case VoxelType::UInt16: return RawType::UInt16;
+		case VoxelType::Float32: return RawType::Float32;
+	}
+	return RawType::UInt8;
+}
+
+/// <summary>
+/// Parses the type names used by NRRD ("short", "uint16", ...), MetaImage ("MET_SHORT", ...) and the command line.
+/// </summary>
+bool parseRawType(std::string name, RawType& type) {
+	std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+	if (name.rfind("met_", 0) == 0)
+		name = name.substr(4);
+	static const std::map<std::string, RawType> names = {
+		{ "char", RawType::Int8 }, { "signed char", RawType::Int8 }, { "int8", RawType::Int8 }, { "int8_t", RawType::Int8 }, { "i8", RawType::Int8 },
+		{ "uchar", RawType::UInt8 }, { "unsigned char", RawType::UInt8 }, { "uint8", RawType::UInt8 }, { "uint8_t", RawType::UInt8 }, { "u8", RawType::UInt8 },
+		{ "short", RawType::Int16 }, { "short int", RawType::Int16 }, { "signed short", RawType::Int16 }, { "signed short int", RawType::Int16 },
+		{ "int16", RawType::Int16 }, { "int16_t", RawType::Int16 }, { "i16", RawType::Int16 },
+		{ "ushort", RawType::UInt16 }, { "unsigned short", RawType::UInt16 }, { "unsigned short int", RawType::UInt16 },
+		{ "uint16", RawType::UInt16 }, { "uint16_t", RawType::UInt16 }, { "u16", RawType::UInt16 },
+		{ "int", RawType::Int32 }, { "signed int", RawType::Int32 }, { "int32", RawType::Int32 }, { "int32_t", RawType::Int32 }, { "i32", RawType::Int32 },
+		{ "uint", RawType::UInt32 }, { "unsigned int", RawType::UInt32 }, { "uint32", RawType::UInt32 }, { "uint32_t", RawType::UInt32 }, { "u32", RawType::UInt32 },
+		{ "float", RawType::Float32 }, { "float32", RawType::Float32 }, { "f32", RawType::Float32 },
+		{ "double", RawType::Float64 }, { "float64", RawType::Float64 }, { "f64", RawType::Float64 }
+	};
+	auto found = names.find(name);
+	if (found == names.end())
+		return false;
+	type = found->second;
+	return true;
+}
+
+enum class VolumeFormat {
+	VOL,
+	NRRD,
+	MHD,
+	Raw
+};
+
+/// <summary>
+/// Picks the format of a volume file from its extension, anything unknown is raw voxels.
+/// </summary>
+VolumeFormat volumeFormatFromPath(const std::string& path) {
+	std::string extension = std::filesystem::path(path).extension().string();
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+	if (extension == ".vol")
+		return VolumeFormat::VOL;
+	if (extension == ".nrrd" || extension == ".nhdr")
+		return VolumeFormat::NRRD;
+	if (extension == ".mhd" || extension == ".mha")
+		return VolumeFormat::MHD;
+	return VolumeFormat::Raw;
+}
+
+/// <summary>
+/// Where and how the voxels of a volume file are stored, x changes the fastest.
+/// </summary>
+struct VolumeFileLayout {
+	std::string data_path;
+	size_t data_offset = 0;
+	glm::ivec3 resolution = glm::ivec3(0);
+	glm::vec3 spacing = glm::vec3(1.0f);
+	RawType type = RawType::UInt8;
+	bool big_endian = false;
+
+	size_t voxelCount() const {
+		return (size_t)resolution.x * resolution.y * resolution.z;
+	}
+
+	size_t sliceSize() const {
+		return (size_t)resolution.x * resolution.y * rawTypeSize(type);
+	}
+};
+
+std::string trimHeaderValue(const std::string& value) {
+	size_t begin = value.find_first_not_of(" \t\r");
+	size_t end = value.find_last_not_of(" \t\r");
+	return begin == std::string::npos ? std::string() : value.substr(begin, end - begin + 1);
+}
+
+// detached data files are relative to their header
+std::string headerRelativePath(const std::string& header_path, const std::string& data_file) {
+	std::filesystem::path data_path(data_file);
+	if (data_path.is_absolute())
+		return data_file;
+	return (std::filesystem::path(header_path).parent_path() / data_path).string();
+}
+
+/// <summary>
+/// Reads the header of a NRRD file (attached .nrrd or detached .nhdr) with raw encoding.
+/// </summary>
+bool readNRRDHeader(const std::string& path, VolumeFileLayout& layout) {
+	std::ifstream header(path, std::ios::binary);
+	std::string line;
+	if (!std::getline(header, line) || line.rfind("NRRD000", 0) != 0) {
+		std::cerr << "[ERROR] Not a NRRD file: " << path << std::endl;
+		return false;
+	}
+
+	std::map<std::string, std::string> fields;
+	while (std::getline(header, line)) {
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+		if (line.empty())
+			break;
+		size_t colon = line.find(": ");
+		if (line[0] == '#' || colon == std::string::npos)
+			continue;
+		std::string key = line.substr(0, colon);
+		std::transform(key.begin(), key.end(), key.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+		fields[key] = trimHeaderValue(line.substr(colon + 2));
+	}
+	size_t header_end = (size_t)header.tellg();
+
+	std::istringstream sizes(fields["sizes"]);
+	if (fields["dimension"] != "3" || !(sizes >> layout.resolution.x >> layout.resolution.y >> layout.resolution.z) || !parseRawType(fields["type"], layout.type)) {
+		std::cerr << "[ERROR] Only 3D scalar NRRD volumes are supported: " << path << std::endl;
+		return false;
+	}
+	if (fields["encoding"] != "raw") {
+		std::cerr << "[ERROR] Only raw NRRD encoding is supported, found " << fields["encoding"] << ": " << path << std::endl;
+		return false;
+	}
+	layout.big_endian = fields["endian"] == "big";
+
+	if (fields.count("spacings")) {
+		std::istringstream spacings(fields["spacings"]);
+		spacings >> layout.spacing.x >> layout.spacing.y >> layout.spacing.z;
+	}
+	else if (fields.count("space directions")) {
+		// the length of each axis direction is its spacing
+		std::string directions = fields["space directions"];
+		std::replace_if(directions.begin(), directions.end(), [](char c) { return c == '(' || c == ')' || c == ','; }, ' ');
+		std::istringstream vectors(directions);
+		for (int axis = 0; axis < 3; ++axis) {
+			glm::vec3 direction;
+			if (vectors >> direction.x >> direction.y >> direction.z)
+				layout.spacing[axis] = glm::length(direction);
+		}
+	}
+
+	std::string data_file = fields.count("data file") ? fields["data file"] : fields["datafile"];
+	long long byte_skip = fields.count("byte skip") ? std::stoll(fields["byte skip"]) : 0;
+	if (data_file.rfind("LIST", 0) == 0 || data_file.find('%') != std::string::npos || byte_skip < 0) {
+		std::cerr << "[ERROR] Multi-file NRRD data and byte skip -1 are not supported: " << path << std::endl;
+		return false;
+	}
+	if (data_file.empty()) {
+		layout.data_path = path;
+		layout.data_offset = header_end + (size_t)byte_skip;
+	}
+	else {
+		layout.data_path = headerRelativePath(path, data_file);
+		layout.data_offset = (size_t)byte_skip;
+	}
+	return true;
+}
+
+/// <summary>
+/// Reads the header of a MetaImage file (.mhd with a separate data file, or .mha with the data following the header).
+/// </summary>
+bool readMHDHeader(const std::string& path, VolumeFileLayout& layout) {
+	std::ifstream header(path, std::ios::binary);
+	if (!header) {
+		std::cerr << "[ERROR] Could not open MetaImage header: " << path << std::endl;
+		return false;
+	}
+
+	std::map<std::string, std::string> fields;
+	std::string line;
+	while (std::getline(header, line)) {
+		size_t equals = line.find('=');
+		if (equals == std::string::npos)
+			continue;
+		std::string key = trimHeaderValue(line.substr(0, equals));
+		fields[key] = trimHeaderValue(line.substr(equals + 1));
+		// ElementDataFile is always the last field
+		if (key == "ElementDataFile")
+			break;
+	}
+	size_t header_end = (size_t)header.tellg();
+
+	std::istringstream sizes(fields["DimSize"]);
+	if (fields["NDims"] != "3" || !(sizes >> layout.resolution.x >> layout.resolution.y >> layout.resolution.z) || !parseRawType(fields["ElementType"], layout.type)) {
+		std::cerr << "[ERROR] Only 3D scalar MetaImage volumes are supported: " << path << std::endl;
+		return false;
+	}
+	auto is_true = [](const std::string& value) { return value == "True" || value == "true" || value == "1"; };
+	if (is_true(fields["CompressedData"]) || (fields.count("ElementNumberOfChannels") && fields["ElementNumberOfChannels"] != "1")) {
+		std::cerr << "[ERROR] Compressed and multi-channel MetaImage volumes are not supported: " << path << std::endl;
+		return false;
+	}
+	layout.big_endian = is_true(fields["ElementByteOrderMSB"]) || is_true(fields["BinaryDataByteOrderMSB"]);
+
+	std::istringstream spacings(fields.count("ElementSpacing") ? fields["ElementSpacing"] : fields["ElementSize"]);
+	spacings >> layout.spacing.x >> layout.spacing.y >> layout.spacing.z;
+
+	std::string data_file = fields["ElementDataFile"];
+	if (data_file.empty() || data_file == "LIST" || data_file.find('%') != std::string::npos) {
+		std::cerr << "[ERROR] MetaImage data file lists are not supported: " << path << std::endl;
+		return false;
+	}
+	layout.data_path = data_file == "LOCAL" ? path : headerRelativePath(path, data_file);
+	long long header_size = fields.count("HeaderSize") ? std::stoll(fields["HeaderSize"]) : 0;
+	if (data_file == "LOCAL")
+		layout.data_offset = header_end + (size_t)std::max(0LL, header_size);
+	else if (header_size >= 0)
+		layout.data_offset = (size_t)header_size;
+	else {
+		// -1 means the voxels are the end of the data file
+		std::error_code error;
+		size_t data_file_size = std::filesystem::file_size(layout.data_path, error);
+		layout.data_offset = data_file_size - std::min(data_file_size, layout.voxelCount() * rawTypeSize(layout.type));
+	}
+	return true;
+}
+
+/// <summary>
+/// Describes a VOL file as a layout, the voxel type is inferred from the payload size like parseVOLHeader does.
+/// </summary>
+bool readVOLLayout(const std::string& path, VolumeFileLayout& layout) {
+	std::error_code error;
+	size_t file_size = std::filesystem::file_size(path, error);
+	std::ifstream VOL_fstream(path, std::ios::binary);
+	unsigned char header_bytes[VOL_HEADER_SIZE];
+	VOLData header;
+	if (error || !VOL_fstream.read((char*)header_bytes, VOL_HEADER_SIZE) || !parseVOLHeader(header_bytes, file_size, header)) {
+		std::cerr << "[ERROR] VOL File is truncated or has an invalid header: " << path << std::endl;
+		return false;
+	}
+	layout.data_path = path;
+	layout.data_offset = VOL_HEADER_SIZE;
+	layout.resolution = header.resolution;
+	layout.spacing = header.true_size / glm::vec3(header.resolution);
+	layout.type = rawTypeOf(header.voxel_type);
+	layout.big_endian = true;
+	return true;
+}
+
+/// <summary>
+/// Reads the layout of a volume file. Raw files have no header, their layout has to be filled in by the caller
+/// and only gets its data path here.
+/// </summary>
+bool readVolumeLayout(const std::string& path, VolumeFileLayout& layout) {
+	bool read = true;
+	switch (volumeFormatFromPath(path)) {
+		case VolumeFormat::VOL: read = readVOLLayout(path, layout); break;
+		case VolumeFormat::NRRD: read = readNRRDHeader(path, layout); break;
+		case VolumeFormat::MHD: read = readMHDHeader(path, layout); break;
+		case VolumeFormat::Raw: layout.data_path = path; break;
+	}
+	if (!read)
+		return false;
+
+	std::error_code error;
+	size_t data_size = std::filesystem::file_size(layout.data_path, error);
+	if (error || layout.voxelCount() == 0 || data_size < layout.data_offset + layout.voxelCount() * rawTypeSize(layout.type)) {
+		std::cerr << "[ERROR] Volume data is missing or smaller than its header describes: " << layout.data_path << std::endl;
+		return false;
+	}
+	return true;
+}
+
+const char* NRRDTypeName(RawType type) {
+	switch (type) {
+		case RawType::Int8: return "int8";
+		case RawType::UInt8: return "uint8";
+		case RawType::Int16: return "int16";
+		case RawType::UInt16: return "uint16";
+		case RawType::Int32: return "int32";
+		case RawType::UInt32: return "uint32";
+		case RawType::Float32: return "float";
+		case RawType::Float64: return "double";
+	}
+	return "";
+}
+
+const char* METTypeName(RawType type) {
+	switch (type) {
+		case RawType::Int8: return "MET_CHAR";
+		case RawType::UInt8: return "MET_UCHAR";
+		case RawType::Int16: return "MET_SHORT";
+		case RawType::UInt16: return "MET_USHORT";
+		case RawType::Int32: return "MET_INT";
+		case RawType::UInt32: return "MET_UINT";
+		case RawType::Float32: return "MET_FLOAT";
+		case RawType::Float64: return "MET_DOUBLE";
+	}
+	return "";
+}
+
+/// <summary>
+/// The file the voxels of an output go into, MetaImage headers keep them in a .raw beside them.
+/// </summary>
+std::string volumeDataPath(const std::string& path) {
+	if (volumeFormatFromPath(path) == VolumeFormat::MHD)
+		return std::filesystem::path(path).replace_extension(".raw").string();
+	return path;
+}
+
+/// <summary>
+/// Writes the header of a volume file and sizes its data file, so the voxels can be written by several threads at once.
+/// VOL files are big endian, the other formats are written in native byte order.
+/// </summary>
+/// <param name="path">The output path, the format follows from its extension. MetaImage data goes into a .raw beside it.</param>
+/// <param name="layout">The resolution, spacing and type to write, receives the data path, offset and byte order.</param>
+bool writeVolumeHeader(const std::string& path, VolumeFileLayout& layout) {
+	std::ostringstream text;
+	VolumeFormat format = volumeFormatFromPath(path);
+	layout.data_path = volumeDataPath(path);
+	layout.big_endian = format == VolumeFormat::VOL ? true : NATIVE_BIG_ENDIAN;
+
+	std::string header;
+	if (format == VolumeFormat::VOL) {
+		if (layout.type != RawType::UInt8 && layout.type != RawType::UInt16 && layout.type != RawType::Float32) {
+			std::cerr << "[ERROR] VOL files hold 8 or 16 bit unsigned or float voxels only." << std::endl;
+			return false;
+		}
+		VOLData data;
+		data.resolution = layout.resolution;
+		data.saved_border = 0;
+		data.true_size = glm::vec3(layout.resolution) * layout.spacing;
+		header.resize(VOL_HEADER_SIZE);
+		encodeVOLHeader(data, (unsigned char*)header.data());
+	}
+	else if (format == VolumeFormat::NRRD) {
+		text << "NRRD0004\n";
+		text << "type: " << NRRDTypeName(layout.type) << "\n";
+		text << "dimension: 3\n";
+		text << "sizes: " << layout.resolution.x << " " << layout.resolution.y << " " << layout.resolution.z << "\n";
+		text << "spacings: " << layout.spacing.x << " " << layout.spacing.y << " " << layout.spacing.z << "\n";
+		text << "endian: " << (layout.big_endian ? "big" : "little") << "\n";
+		text << "encoding: raw\n\n";
+		header = text.str();
+	}
+	else if (format == VolumeFormat::MHD) {
+		text << "ObjectType = Image\n";
+		text << "NDims = 3\n";
+		text << "DimSize = " << layout.resolution.x << " " << layout.resolution.y << " " << layout.resolution.z << "\n";
+		text << "ElementSpacing = " << layout.spacing.x << " " << layout.spacing.y << " " << layout.spacing.z << "\n";
+		text << "ElementByteOrderMSB = " << (layout.big_endian ? "True" : "False") << "\n";
+		text << "ElementType = " << METTypeName(layout.type) << "\n";
+		text << "ElementDataFile = " << std::filesystem::path(layout.data_path).filename().string() << "\n";
+		std::ofstream MHD_fstream(path, std::ios::binary);
+		if (!(MHD_fstream << text.str())) {
+			std::cerr << "[ERROR] Could not write " << path << std::endl;
+			return false;
+		}
+	}
+
+	std::ofstream data_fstream(layout.data_path, std::ios::binary | std::ios::trunc);
+	if (!data_fstream.write(header.data(), header.size())) {
+		std::cerr << "[ERROR] Could not write " << layout.data_path << std::endl;
+		return false;
+	}
+	data_fstream.close();
+	layout.data_offset = header.size();
+
+	std::error_code error;
+	std::filesystem::resize_file(layout.data_path, layout.data_offset + layout.voxelCount() * rawTypeSize(layout.type), error);
+	if (error) {
+		std::cerr << "[ERROR] Could not size " << layout.data_path << ": " << error.message() << std::endl;
+		return false;
+	}
+	return true;
+}
+
+template <typename T>
+void decodeTypedToFloat(const unsigned char* source, bool swap, size_t count, float* destination) {
+	for (size_t i = 0; i < count; ++i) {
+		unsigned char bytes[sizeof(T)];
+		std::memcpy(bytes, source + i * sizeof(T), sizeof(T));
+		if (swap)
+			std::reverse(bytes, bytes + sizeof(T));
+		T value;
+		std::memcpy(&value, bytes, sizeof(T));
+		destination[i] = (float)value;
+	}
+}
+
+/// <summary>
+/// Converts count values of the given type and byte order to floats.
+/// </summary>
+void decodeToFloat(const unsigned char* source, RawType type, bool big_endian, size_t count, float* destination) {
+	bool swap = big_endian != NATIVE_BIG_ENDIAN;
+	switch (type) {
+		case RawType::Int8: decodeTypedToFloat<int8_t>(source, false, count, destination); break;
+		case RawType::UInt8: decodeTypedToFloat<uint8_t>(source, false, count, destination); break;
+		case RawType::Int16: decodeTypedToFloat<int16_t>(source, swap, count, destination); break;
+		case RawType::UInt16: decodeTypedToFloat<uint16_t>(source, swap, count, destination); break;
+		case RawType::Int32: decodeTypedToFloat<int32_t>(source, swap, count, destination); break;
+		case RawType::UInt32: decodeTypedToFloat<uint32_t>(source, swap, count, destination); break;
+		case RawType::Float32: decodeTypedToFloat<float>(source, swap, count, destination); break;
+		case RawType::Float64: decodeTypedToFloat<double>(source, swap, count, destination); break;
+	}
+}
+
+/// <summary>
+/// Converts count floats to value * scale + offset in one of the VOL voxel types, rounding and clamping integers.
+/// </summary>
+void encodeFromFloat(const float* source, size_t count, RawType type, glm::vec2 transform, bool big_endian, unsigned char* destination) {
+	for (size_t i = 0; i < count; ++i) {
+		float value = source[i] * transform.x + transform.y;
+		if (type == RawType::UInt8) {
+			destination[i] = (unsigned char)std::clamp(std::lround(value), 0L, 255L);
+		}
+		else if (type == RawType::UInt16) {
+			uint16_t bits = (uint16_t)std::clamp(std::lround(value), 0L, 65535L);
+			if (big_endian != NATIVE_BIG_ENDIAN)
+				bits = byteswap16(bits);
+			std::memcpy(destination + 2 * i, &bits, 2);
+		}
+		else {
+			uint32_t bits;
+			std::memcpy(&bits, &value, 4);
+			if (big_endian != NATIVE_BIG_ENDIAN)
+				bits = byteswap32(bits);
+			std::memcpy(destination + 4 * i, &bits, 4);
+		}
+	}
+}
+
+struct ConversionOptions {
+	// the voxel type written, by default the VOL type closest to the source type
+	bool has_target_type = false;
+	VoxelType target_type = VoxelType::UInt8;
+	// maps the range of the source values onto the whole range of the target type ([0, 1] for floats)
+	bool normalize = false;
+	// resamples to this resolution, 0 keeps the source resolution
+	glm::ivec3 resample_resolution = glm::ivec3(0);
+	// the filter the visualizer resamples with by default, stretched when downsampling so nothing aliases
+	ResampleFilter resample_filter = ResampleFilter::Lanczos;
+	unsigned int threads = parallelThreadCount();
+	// the output is converted in z slabs of roughly this many bytes, one slab per thread at a time
+	size_t chunk_bytes = (size_t)64 << 20;
+};
+
+/// <summary>
+/// The VOL voxel type a source type converts to by default, signed integers are shifted to unsigned.
+/// </summary>
+VoxelType defaultTargetType(RawType type, glm::vec2& transform) {
+	transform = glm::vec2(1.0f, 0.0f);
+	switch (type) {
+		case RawType::Int8: transform.y = 128.0f; return VoxelType::UInt8;
+		case RawType::UInt8: return VoxelType::UInt8;
+		case RawType::Int16: transform.y = 32768.0f; return VoxelType::UInt16;
+		case RawType::UInt16: return VoxelType::UInt16;
+		default: return VoxelType::Float32;
+	}
+}
+
+/// <summary>
+/// Runs process(z_begin, z_end, thread_index) over slabs of output slices, spread across threads that pick
+/// up the next slab as soon as they are done with theirs.
+/// </summary>
+bool forEachSlab(int slices, int slab_slices, unsigned int threads, const std::function<bool(int, int, unsigned int)>& process) {
+	std::atomic<int> next_slab{ 0 };
+	std::atomic<bool> failed{ false };
+	int slabs = (slices + slab_slices - 1) / slab_slices;
+	parallelFor(0, std::min<size_t>(threads, (size_t)slabs), [&](size_t first, size_t last, unsigned int thread_index) {
+		for (size_t worker = first; worker < last; ++worker) {
+			for (int slab = next_slab++; slab < slabs && !failed; slab = next_slab++) {
+				int z_begin = slab * slab_slices;
+				if (!process(z_begin, std::min(slices, z_begin + slab_slices), thread_index))
+					failed = true;
+			}
+		}
+	});
+	return !failed;
+}
+
+/// <summary>
+/// Finds the range of the source values in one streaming pass, for normalizing.
+/// </summary>
+bool findValueRange(const VolumeFileLayout& source, const ConversionOptions& options, glm::vec2& range) {
+	int slab_slices = (int)std::max<size_t>(1, options.chunk_bytes / source.sliceSize());
+	std::vector<glm::vec2> partials(parallelThreadCount(), glm::vec2(std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest()));
+	bool completed = forEachSlab(source.resolution.z, slab_slices, options.threads, [&](int z_begin, int z_end, unsigned int thread_index) {
+		std::ifstream source_fstream(source.data_path, std::ios::binary);
+		std::vector<unsigned char> bytes((size_t)(z_end - z_begin) * source.sliceSize());
+		std::vector<float> values(bytes.size() / rawTypeSize(source.type));
+		source_fstream.seekg((std::streamoff)(source.data_offset + (size_t)z_begin * source.sliceSize()));
+		if (!source_fstream.read((char*)bytes.data(), (std::streamsize)bytes.size()))
+			return false;
+		decodeToFloat(bytes.data(), source.type, source.big_endian, values.size(), values.data());
+		auto [low, high] = std::minmax_element(values.begin(), values.end());
+		partials[thread_index] = glm::vec2(std::min(partials[thread_index].x, *low), std::max(partials[thread_index].y, *high));
+		return true;
+	});
+	range = partials[0];
+	for (const glm::vec2& partial : partials)
+		range = glm::vec2(std::min(range.x, partial.x), std::max(range.y, partial.y));
+	return completed;
+}
+
+/// <summary>
+/// Converts a volume file into another format, type and optionally resolution. The output is processed in z slabs
+/// spread across threads, each reading its source slices and writing its output slab through its own file streams,
+/// so memory stays bounded and the disk stays busy.
+/// </summary>
+/// <param name="source">The layout of the input, see readVolumeLayout.</param>
+/// <param name="output_path">The output file, its format follows from its extension.</param>
+/// <returns>Whether the whole volume was converted.</returns>
+bool convertVolume(const VolumeFileLayout& source, const std::string& output_path, const ConversionOptions& options) {
+	glm::vec2 transform;
+	VoxelType target_type = defaultTargetType(source.type, transform);
+	if (options.has_target_type) {
+		target_type = options.target_type;
+		transform = glm::vec2(1.0f, 0.0f);
+	}
+	if (options.normalize) {
+		glm::vec2 range;
+		if (!findValueRange(source, options, range))
+			return false;
+		float target_max = target_type == VoxelType::UInt8 ? 255.0f : (target_type == VoxelType::UInt16 ? 65535.0f : 1.0f);
+		transform.x = range.y > range.x ? target_max / (range.y - range.x) : 1.0f;
+		transform.y = -range.x * transform.x;
+	}
+
+	std::error_code error;
+	if (std::filesystem::equivalent(source.data_path, volumeDataPath(output_path), error)) {
+		std::cerr << "[ERROR] The output would overwrite the input: " << volumeDataPath(output_path) << std::endl;
+		return false;
+	}
+
+	VolumeFileLayout target;
+	target.resolution = glm::all(glm::greaterThan(options.resample_resolution, glm::ivec3(0))) ? options.resample_resolution : source.resolution;
+	target.spacing = source.spacing * glm::vec3(source.resolution) / glm::vec3(target.resolution);
+	target.type = rawTypeOf(target_type);
+	if (!writeVolumeHeader(output_path, target))
+		return false;
+
+	bool resampling = target.resolution != source.resolution;
+	// the same type with no value transform only needs its byte order fixed
+	bool copy_values = !resampling && source.type == target.type && transform == glm::vec2(1.0f, 0.0f);
+	int slab_slices = (int)std::max<size_t>(1, options.chunk_bytes / std::max(source.sliceSize(), target.sliceSize()));
+	ResampleTaps x_taps, y_taps, z_taps;
+	if (resampling) {
+		x_taps = computeResampleTaps(source.resolution.x, target.resolution.x, options.resample_filter);
+		y_taps = computeResampleTaps(source.resolution.y, target.resolution.y, options.resample_filter);
+		z_taps = computeResampleTaps(source.resolution.z, target.resolution.z, options.resample_filter);
+	}
+
+	return forEachSlab(target.resolution.z, slab_slices, options.threads, [&](int z_begin, int z_end, unsigned int) {
+		// the source slices the slab samples from, as far as the z taps of its slices reach
+		int source_begin = z_begin, source_end = z_end;
+		if (resampling) {
+			source_begin = source.resolution.z;
+			source_end = 0;
+			for (size_t t = z_taps.first[z_begin]; t < z_taps.first[z_end]; ++t) {
+				source_begin = std::min(source_begin, z_taps.index[t]);
+				source_end = std::max(source_end, z_taps.index[t] + 1);
+			}
+		}
+
+		std::ifstream source_fstream(source.data_path, std::ios::binary);
+		std::vector<unsigned char> source_bytes((size_t)(source_end - source_begin) * source.sliceSize());
+		source_fstream.seekg((std::streamoff)(source.data_offset + (size_t)source_begin * source.sliceSize()));
+		if (!source_fstream.read((char*)source_bytes.data(), (std::streamsize)source_bytes.size())) {
+			std::cerr << "[ERROR] Could not read " << source.data_path << std::endl;
+			return false;
+		}
+
+		size_t target_count = (size_t)(z_end - z_begin) * target.resolution.x * target.resolution.y;
+		std::vector<unsigned char> target_bytes(target_count * rawTypeSize(target.type));
+		if (copy_values) {
+			if (source.big_endian == target.big_endian || rawTypeSize(source.type) == 1)
+				target_bytes.swap(source_bytes);
+			else if (rawTypeSize(source.type) == 2)
+				swapBytes16(source_bytes.data(), target_bytes.data(), target_count);
+			else
+				swapBytes32(source_bytes.data(), target_bytes.data(), target_count);
+		}
+		else {
+			std::vector<float> values(source_bytes.size() / rawTypeSize(source.type));
+			decodeToFloat(source_bytes.data(), source.type, source.big_endian, values.size(), values.data());
+			if (resampling) {
+				// the source slices are filtered along x and y, then the slab slices from those along z, as the visualizer resamples
+				size_t source_slice = (size_t)source.resolution.x * source.resolution.y;
+				size_t target_slice = (size_t)target.resolution.x * target.resolution.y;
+				std::vector<float> planes((size_t)(source_end - source_begin) * target_slice), rows;
+				glm::ivec2 source_size(source.resolution.x, source.resolution.y), target_size(target.resolution.x, target.resolution.y);
+				for (int z = source_begin; z < source_end; ++z)
+					resampleSlice(values.data() + (size_t)(z - source_begin) * source_slice, source_size, target_size, x_taps, y_taps, rows,
+						planes.data() + (size_t)(z - source_begin) * target_slice);
+
+				std::vector<float> resampled(target_count, 0.0f);
+				for (int z = z_begin; z < z_end; ++z) {
+					float* out = resampled.data() + (size_t)(z - z_begin) * target_slice;
+					for (size_t t = z_taps.first[z]; t < z_taps.first[z + 1]; ++t) {
+						const float* plane = planes.data() + (size_t)(z_taps.index[t] - source_begin) * target_slice;
+						float weight = z_taps.weights[t];
+						for (size_t i = 0; i < target_slice; ++i)
+							out[i] += weight * plane[i];
+					}
+				}
+				values.swap(resampled);
+			}
+			encodeFromFloat(values.data(), target_count, target.type, transform, target.big_endian, target_bytes.data());
+		}
+
+		std::fstream target_fstream(target.data_path, std::ios::binary | std::ios::in | std::ios::out);
+		target_fstream.seekp((std::streamoff)(target.data_offset + (size_t)z_begin * target.sliceSize()));
+		if (!target_fstream.write((const char*)target_bytes.data(), (std::streamsize)target_bytes.size())) {
+			std::cerr << "[ERROR] Could not write " << target.data_path << std::endl;
+			return false;
+		}
+		return true;
+	});
+}
@@ -0,0 +1,146 @@
+#pragma once
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <vector>
+
+#include "BrickedVolume.h"
+#include "Parallel.h"
+#include "VOLParser.h"
+
+// the gradient volume is RGBA8: the unit normal mapped from [-1, 1] to [0, 255] in rgb and the gradient magnitude,
+// relative to the largest one in the volume, in a
+const size_t VOL_GRADIENT_BYTES = 4;
+
+/// <summary>
+/// The gradients of a row of voxels by central differences, one-sided at the border, in value units per texture coordinate.
+/// They point towards lower values, i.e. out of a dense object, like the normals shade() used to take from six samples.
+/// </summary>
+template <typename T>
+void rowGradients(const T* values, glm::ivec3 resolution, int y, int z, glm::vec3* gradients) {
+	size_t row_stride = resolution.x, slice_stride = (size_t)resolution.x * resolution.y;
+	const T* row = values + z * slice_stride + y * row_stride;
+	// neighbouring rows, a row at the border is its own neighbour and the difference is one-sided
+	int y_below = y > 0 ? 1 : 0, y_above = y < resolution.y - 1 ? 1 : 0;
+	int z_below = z > 0 ? 1 : 0, z_above = z < resolution.z - 1 ? 1 : 0;
+	const T* y_lower = row - y_below * row_stride;
+	const T* y_upper = row + y_above * row_stride;
+	const T* z_lower = row - z_below * slice_stride;
+	const T* z_upper = row + z_above * slice_stride;
+	float y_scale = y_below + y_above == 0 ? 0.0f : resolution.y / (float)(y_below + y_above);
+	float z_scale = z_below + z_above == 0 ? 0.0f : resolution.z / (float)(z_below + z_above);
+	for (int x = 0; x < resolution.x; ++x) {
+		int x_lower = std::max(x - 1, 0), x_upper = std::min(x + 1, resolution.x - 1);
+		float x_scale = x_upper == x_lower ? 0.0f : resolution.x / (float)(x_upper - x_lower);
+		gradients[x] = glm::vec3(
+			((float)row[x_lower] - (float)row[x_upper]) * x_scale,
+			((float)y_lower[x] - (float)y_upper[x]) * y_scale,
+			((float)z_lower[x] - (float)z_upper[x]) * z_scale);
+	}
+}
+
+template <typename T>
+bool computeTypedVOLGradients(const T* values, glm::ivec3 resolution, std::vector<unsigned char>& gradients, const std::function<bool(float)>& report) {
+	std::atomic<size_t> done{ 0 };
+	std::atomic<bool> cancelled{ false };
+	size_t total = 2 * (size_t)resolution.z;
+
+	// the first pass finds the largest squared magnitude, which the second one encodes the magnitudes relative to
+	std::vector<float> largest(parallelThreadCount(), 0.0f);
+	parallelFor(0, resolution.z, [&](size_t z_begin, size_t z_end, unsigned int thread_index) {
+		std::vector<glm::vec3> row(resolution.x);
+		float thread_largest = 0.0f;
+		for (size_t z = z_begin; z < z_end && !cancelled; ++z) {
+			for (int y = 0; y < resolution.y; ++y) {
+				rowGradients(values, resolution, y, (int)z, row.data());
+				for (const glm::vec3& gradient : row)
+					thread_largest = std::max(thread_largest, glm::dot(gradient, gradient));
+			}
+			if (report && !report((float)++done / total))
+				cancelled = true;
+		}
+		largest[thread_index] = std::max(largest[thread_index], thread_largest);
+	});
+	if (cancelled)
+		return false;
+
+	float magnitude_scale = 0.0f;
+	float largest_magnitude = std::sqrt(*std::max_element(largest.begin(), largest.end()));
+	if (largest_magnitude > 0.0f)
+		magnitude_scale = 255.0f / largest_magnitude;
+
+	parallelFor(0, resolution.z, [&](size_t z_begin, size_t z_end, unsigned int) {
+		std::vector<glm::vec3> row(resolution.x);
+		for (size_t z = z_begin; z < z_end && !cancelled; ++z) {
+			unsigned char* out = gradients.data() + z * resolution.x * resolution.y * VOL_GRADIENT_BYTES;
+			for (int y = 0; y < resolution.y; ++y) {
+				rowGradients(values, resolution, y, (int)z, row.data());
+				for (const glm::vec3& gradient : row) {
+					float magnitude = glm::length(gradient);
+					glm::vec3 normal = magnitude > 0.0f ? gradient / magnitude : glm::vec3(0.0f);
+					for (int axis = 0; axis < 3; ++axis)
+						out[axis] = (unsigned char)std::lround((normal[axis] * 0.5f + 0.5f) * 255.0f);
+					out[3] = (unsigned char)std::min(255L, std::lround(magnitude * magnitude_scale));
+					out += VOL_GRADIENT_BYTES;
+				}
+			}
+			if (report && !report((float)++done / total))
+				cancelled = true;
+		}
+	});
+	return !cancelled;
+}
+
+/// <summary>
+/// Computes the gradient of every voxel once, in two multithreaded passes, so the renderer shades with one fetch per sample.
+/// </summary>
+/// <param name="data">The volume with its dense values, data.gradients receives the result.</param>
+/// <param name="report">Optional, called from the worker threads with the fraction done, returning false cancels the pass.</param>
+/// <returns>False if the pass was cancelled, in which case data.gradients is left untouched.</returns>
+bool computeVOLGradients(VOLData& data, const std::function<bool(float)>& report = nullptr) {
+	if (data.values.size() < voxelCount(data) * voxelSize(data.voxel_type) || voxelCount(data) == 0)
+		return false;
+
+	std::vector<unsigned char> gradients(voxelCount(data) * VOL_GRADIENT_BYTES);
+	bool completed = false;
+	switch (data.voxel_type) {
+		case VoxelType::UInt8:
+			completed = computeTypedVOLGradients(data.values.data(), data.resolution, gradients, report);
+			break;
+		case VoxelType::UInt16:
+			completed = computeTypedVOLGradients((const unsigned short*)data.values.data(), data.resolution, gradients, report);
+			break;
+		case VoxelType::Float32:
+			completed = computeTypedVOLGradients((const float*)data.values.data(), data.resolution, gradients, report);
+			break;
+	}
+	if (!completed)
+		return false;
+	data.gradients = std::move(gradients);
+	return true;
+}
+
+/// <summary>
+/// Rearranges the gradients of a bricked volume like its brick pool, so they are sampled at the same coordinates.
+/// </summary>
+/// <param name="gradients">The gradients of the dense volume.</param>
+/// <returns>The gradients of the occupied bricks with their ghost voxels, in the pool layout.</returns>
+std::vector<unsigned char> brickVOLGradients(const VOLValues& gradients, const BrickedVolume& bricked) {
+	const BrickLayout& layout = bricked.layout;
+	glm::ivec3 pool_resolution = layout.poolResolution();
+	std::vector<unsigned char> pool((size_t)pool_resolution.x * pool_resolution.y * pool_resolution.z * VOL_GRADIENT_BYTES);
+	parallelFor(0, layout.pageCount(), [&](size_t begin, size_t end, unsigned int) {
+		for (size_t page = begin; page < end; ++page) {
+			const unsigned char* entry = bricked.page_table.data() + page * 4;
+			if (entry[3] == 0)
+				continue;
+			// a texel of four bytes moves as one
+			copyBrickToPool((const unsigned int*)gradients.data(), layout.resolution, layout.brickOfPage(page), (unsigned int*)pool.data(),
+				pool_resolution, glm::ivec3(entry[0], entry[1], entry[2]));
+		}
+	});
+	return pool;
+}
@@ -5,22 +5,258 @@
 #include <sstream>
 #include <iostream>
 #include <filesystem>
-#include <bit>
+#include <memory>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include <glm/glm.hpp>
 
-int _endian_check = 1;
-#define LITTLE_ENDIAN (*(char *)&_endian_check == 1)
+#include "Endian.h"
+
+const size_t VOL_HEADER_SIZE = 28;
+
+/// <summary>
+/// The type of the voxels of a VOL file. The header has no field for it, so it follows from the payload size
+/// (1, 2 or 4 bytes per voxel). Multi-byte voxels are stored big endian in the file.
+/// </summary>
+enum class VoxelType {
+	UInt8,
+	UInt16,
+	Float32
+};
+
+size_t voxelSize(VoxelType type) {
+	switch (type) {
+		case VoxelType::UInt8: return 1;
+		case VoxelType::UInt16: return 2;
+		case VoxelType::Float32: return 4;
+	}
+	return 1;
+}
+
+const char* voxelTypeName(VoxelType type) {
+	switch (type) {
+		case VoxelType::UInt8: return "8-bit unsigned";
+		case VoxelType::UInt16: return "16-bit unsigned";
+		case VoxelType::Float32: return "32-bit float";
+	}
+	return "";
+}
+
+/// <summary>
+/// A read-only memory mapping of an entire file. The mapping is released on destruction or by calling release().
+/// </summary>
+class MappedFile {
+	public:
+		MappedFile() {}
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		~MappedFile() {
+			release();
+		}
+
+		bool open(const char* file_path) {
+			release();
+#ifdef _WIN32
+			file_handle = CreateFileA(file_path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+			if (file_handle == INVALID_HANDLE_VALUE)
+				return false;
+			LARGE_INTEGER file_size;
+			if (!GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart == 0) {
+				release();
+				return false;
+			}
+			mapping_handle = CreateFileMappingA(file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (mapping_handle == NULL) {
+				release();
+				return false;
+			}
+			mapped = (const unsigned char*)MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0);
+			mapped_size = (size_t)file_size.QuadPart;
+#else
+			file_descriptor = ::open(file_path, O_RDONLY);
+			if (file_descriptor < 0)
+				return false;
+			struct stat file_stat;
+			if (fstat(file_descriptor, &file_stat) != 0 || file_stat.st_size == 0) {
+				release();
+				return false;
+			}
+			void* address = mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+			mapped = address == MAP_FAILED ? nullptr : (const unsigned char*)address;
+			mapped_size = (size_t)file_stat.st_size;
+			if (mapped != nullptr)
+				madvise(address, mapped_size, MADV_SEQUENTIAL);
+#endif
+			if (mapped == nullptr) {
+				release();
+				return false;
+			}
+			return true;
+		}
+
+		void release() {
+#ifdef _WIN32
+			if (mapped != nullptr)
+				UnmapViewOfFile(mapped);
+			if (mapping_handle != NULL)
+				CloseHandle(mapping_handle);
+			if (file_handle != INVALID_HANDLE_VALUE)
+				CloseHandle(file_handle);
+			mapping_handle = NULL;
+			file_handle = INVALID_HANDLE_VALUE;
+#else
+			if (mapped != nullptr)
+				munmap((void*)mapped, mapped_size);
+			if (file_descriptor >= 0)
+				close(file_descriptor);
+			file_descriptor = -1;
+#endif
+			mapped = nullptr;
+			mapped_size = 0;
+		}
+
+		const unsigned char* data() const {
+			return mapped;
+		}
+
+		size_t size() const {
+			return mapped_size;
+		}
+
+	private:
+		const unsigned char* mapped = nullptr;
+		size_t mapped_size = 0;
+#ifdef _WIN32
+		HANDLE file_handle = INVALID_HANDLE_VALUE;
+		HANDLE mapping_handle = NULL;
+#else
+		int file_descriptor = -1;
+#endif
+};
+
+/// <summary>
+/// The voxel payload of a VOL file, always in native byte order. Either owns its bytes, or is a view over a MappedFile
+/// that keeps the mapping alive until release() is called (i.e. once the GPU upload has completed).
+/// </summary>
+class VOLValues {
+	public:
+		VOLValues() {}
+
+		VOLValues& operator=(std::vector<unsigned char> bytes) {
+			mapping.reset();
+			offset = 0;
+			count = bytes.size();
+			owned = std::make_shared<const std::vector<unsigned char>>(std::move(bytes));
+			return *this;
+		}
 
+		void view(std::shared_ptr<MappedFile> file, size_t byte_offset, size_t byte_count) {
+			owned.reset();
+			mapping = std::move(file);
+			offset = byte_offset;
+			count = byte_count;
+		}
+
+		void release() {
+			owned.reset();
+			mapping.reset();
+			offset = 0;
+			count = 0;
+		}
+
+		const unsigned char* data() const {
+			if (mapping)
+				return mapping->data() + offset;
+			return owned ? owned->data() : nullptr;
+		}
+
+		size_t size() const {
+			return count;
+		}
+
+		bool empty() const {
+			return count == 0;
+		}
+
+		bool isMapped() const {
+			return mapping != nullptr;
+		}
+
+		const unsigned char& operator[](size_t index) const {
+			return data()[index];
+		}
+
+		const unsigned char* begin() const {
+			return data();
+		}
+
+		const unsigned char* end() const {
+			return data() + count;
+		}
+
+	private:
+		// shared and immutable, so copies of a VOLData (e.g. in the residency cache) cost no voxel copies
+		std::shared_ptr<const std::vector<unsigned char>> owned;
+		std::shared_ptr<MappedFile> mapping;
+		size_t offset = 0;
+		size_t count = 0;
+};
+
+/// <summary>
+/// Summary statistics of the voxel values, computed once by computeVOLStatistics (VOLStatistics.h) and cached on the VOLData.
+/// </summary>
+struct VOLStatistics {
+	bool computed = false;
+	// in the units of the voxel type
+	float min_value = 0.0f, max_value = 0.0f;
+	double mean = 0.0, variance = 0.0;
+	// 256 bins over the range the transfer function covers, see transferFunctionDomain in VOLStatistics.h
+	std::vector<unsigned long long> histogram = std::vector<unsigned long long>(256);
+	// bounding box of the non-zero voxels in voxel coordinates, inclusive, min > max when every voxel is zero
+	glm::ivec3 nonzero_min = glm::ivec3(0), nonzero_max = glm::ivec3(-1);
+	double empty_fraction = 1.0;
+};
+
+// see BrickedVolume.h and MacrocellGrid.h
+struct BrickedVolume;
+struct MacrocellGrid;
 
 struct VOLData {
 	std::string name;
 	glm::ivec3 resolution;
 	int saved_border;
 	glm::vec3 true_size;
-	std::vector<unsigned char> values;
+	VoxelType voxel_type = VoxelType::UInt8;
+	VOLValues values;
+	VOLStatistics statistics;
+	// RGBA8 normals and gradient magnitudes laid out like the texture, i.e. like the brick pool of a bricked volume, see VOLGradients.h
+	VOLValues gradients;
+	// the non-empty bricks of a sparse volume, which then need not keep its dense values
+	std::shared_ptr<const BrickedVolume> bricks;
+	// the value range of every macrocell, for skipping the cells the transfer function hides
+	std::shared_ptr<const MacrocellGrid> macrocells;
 };
 
+size_t voxelCount(const VOLData& data) {
+	return (size_t)data.resolution.x * data.resolution.y * data.resolution.z;
+}
+
 void printVOLData(const VOLData& data) {
 	std::cout << "----- " << data.name << " Volume Data -----" << std::endl;
 	std::cout << "Resolution: ";
@@ -36,38 +272,38 @@ void printVOLData(const VOLData& data) {
 		if (i != 2) std::cout << ", ";
 	}
 	std::cout << std::endl;
-	std::cout << "Values: " << data.values.size() << std::endl << std::endl;
-	unsigned char min_val = 255, max_val = 0;
-	for (unsigned char x : data.values) {
-		min_val = std::min(min_val, x);
-		max_val = std::max(max_val, x);
+	std::cout << "Voxel Type: " << voxelTypeName(data.voxel_type) << std::endl;
+	std::cout << "Values: " << data.values.size() / voxelSize(data.voxel_type) << std::endl << std::endl;
+	const VOLStatistics& stats = data.statistics;
+	if (!stats.computed) {
+		std::cout << "Statistics: not computed" << std::endl;
+		return;
 	}
-	std::cout << "Range of Values: min " << (int)min_val << " max " << (int)max_val << std::endl;
+	std::cout << "Range of Values: min " << stats.min_value << " max " << stats.max_value << std::endl;
+	std::cout << "Mean: " << stats.mean << " Variance: " << stats.variance << std::endl;
+	std::cout << "Non-zero Bounds: ";
+	for (int i = 0; i < 3; ++i) {
+		std::cout << stats.nonzero_min[i] << "-" << stats.nonzero_max[i];
+		if (i != 2) std::cout << ", ";
+	}
+	std::cout << std::endl;
+	std::cout << "Empty Fraction: " << stats.empty_fraction << std::endl;
 }
 // values are big endian so a[0] is largest and a[3] is smallest
+int get_int(const unsigned char* buffer, size_t index) {
+	return loadBigEndian<int32_t>(buffer + index);
+}
+
+float get_float(const unsigned char* buffer, size_t index) {
+	return loadBigEndian<float>(buffer + index);
+}
+
 int get_int(std::vector<unsigned char>& buffer, int index) {
-	if (LITTLE_ENDIAN) {
-		return int(
-			buffer[index] << 24 |
-			buffer[index + 1] << 16 |
-			buffer[index + 2] << 8 |
-			buffer[index + 3]
-			);
-	} else {
-		return int(
-			buffer[index] |
-			buffer[index + 1] << 8 |
-			buffer[index + 2] << 16 |
-			buffer[index + 3] << 24
-			);
-	}
+	return get_int(buffer.data(), index);
 }
 
 float get_float(std::vector<unsigned char>& buffer, int index) {
-	float result;
-	int binary = get_int(buffer, index);
-	std::memcpy(&result, &binary, sizeof(int));
-	return result;
+	return get_float(buffer.data(), index);
 }
 
 void load_template(VOLData& data) {
@@ -83,9 +319,67 @@ void load_template(VOLData& data) {
 	data.true_size.y = 1.0;
 	data.true_size.z = 1.0;
 
+	data.voxel_type = VoxelType::UInt8;
 	data.values = std::vector<unsigned char>(1);
 }
 
+/// <summary>
+/// Parses the 28 byte big endian VOL header in place.
+/// </summary>
+/// <param name="bytes">The start of the file contents.</param>
+/// <param name="size">The size of the file contents in bytes.</param>
+/// <param name="data">The volume data that receives the header fields and the voxel type.</param>
+/// <returns>False if the file is too small to hold the header and the voxels it describes.</returns>
+bool parseVOLHeader(const unsigned char* bytes, size_t size, VOLData& data) {
+	if (size < VOL_HEADER_SIZE)
+		return false;
+
+	data.resolution.z = get_int(bytes, 0); // changes the slowest
+	data.resolution.y = get_int(bytes, 4);
+	data.resolution.x = get_int(bytes, 8); // changes the fastest
+
+	data.saved_border = get_int(bytes, 12);
+
+	data.true_size.z = get_float(bytes, 16);
+	data.true_size.y = get_float(bytes, 20);
+	data.true_size.x = get_float(bytes, 24);
+
+	if (data.resolution.x <= 0 || data.resolution.y <= 0 || data.resolution.z <= 0)
+		return false;
+	size_t voxel_count = voxelCount(data);
+	size_t payload_size = size - VOL_HEADER_SIZE;
+	if (payload_size == 2 * voxel_count)
+		data.voxel_type = VoxelType::UInt16;
+	else if (payload_size == 4 * voxel_count)
+		data.voxel_type = VoxelType::Float32;
+	else
+		data.voxel_type = VoxelType::UInt8;
+	return payload_size >= voxel_count;
+}
+
+/// <summary>
+/// Encodes the 28 byte big endian VOL header of a volume, the voxels follow it big endian too.
+/// </summary>
+void encodeVOLHeader(const VOLData& data, unsigned char* bytes) {
+	storeBigEndian<int32_t>(data.resolution.z, bytes);
+	storeBigEndian<int32_t>(data.resolution.y, bytes + 4);
+	storeBigEndian<int32_t>(data.resolution.x, bytes + 8);
+	storeBigEndian<int32_t>(data.saved_border, bytes + 12);
+	storeBigEndian<float>(data.true_size.z, bytes + 16);
+	storeBigEndian<float>(data.true_size.y, bytes + 20);
+	storeBigEndian<float>(data.true_size.x, bytes + 24);
+}
+
+/// <summary>
+/// Converts big endian multi-byte voxels into native byte order in a buffer of their own.
+/// </summary>
+std::vector<unsigned char> convertVOLPayload(const unsigned char* payload, const VOLData& data) {
+	size_t value_size = voxelSize(data.voxel_type);
+	std::vector<unsigned char> converted(voxelCount(data) * value_size);
+	bigEndianToNative(payload, converted.data(), voxelCount(data), value_size);
+	return converted;
+}
+
 VOLData parseVOLDataFromFile(const char* VOL_filepath) {
 	std::filesystem::path file_path(VOL_filepath);
 
@@ -122,17 +416,59 @@ VOLData parseVOLDataFromFile(const char* VOL_filepath) {
 	data.name = std::string(VOL_filepath);
 	data.name = data.name.substr(0, data.name.find_last_of("."));
 
-	data.resolution.z = get_int(file_data, 0); // changes the slowest
-	data.resolution.y = get_int(file_data, 4);
-	data.resolution.x = get_int(file_data, 8); // changes the fastest
+	if (!parseVOLHeader(file_data.data(), file_data.size(), data)) {
+		std::cerr << "[ERROR] VOL File is truncated or has an invalid header. Loading placeholder." << std::endl;
+
+		load_template(data);
+		return data;
+	}
+
+	if (data.voxel_type == VoxelType::UInt8)
+		data.values = std::vector<unsigned char>(file_data.begin() + VOL_HEADER_SIZE, file_data.end());
+	else
+		data.values = convertVOLPayload(file_data.data() + VOL_HEADER_SIZE, data);
+
+	return data;
+}
+
+/// <summary>
+/// Loads a VOL file without copying it, the header is parsed in place and the voxels are a view over a
+/// memory mapping of the file. Multi-byte voxels are converted to native byte order as they are copied out of the
+/// mapping, unless the host is big endian too. Falls back to parseVOLDataFromFile when the file cannot be mapped.
+/// </summary>
+/// <param name="VOL_filepath">The path of the VOL file.</param>
+/// <returns>The volume data, call values.release() once it has been uploaded to release the mapping.</returns>
+VOLData parseVOLDataFromMappedFile(const char* VOL_filepath) {
+	std::filesystem::path file_path(VOL_filepath);
+
+	VOLData data;
+
+	if (!std::filesystem::exists(file_path)) {
+		load_template(data);
+		return data;
+	}
+
+	std::shared_ptr<MappedFile> mapping = std::make_shared<MappedFile>();
+	if (!mapping->open(VOL_filepath)) {
+		std::cerr << "[ERROR] Mapping VOL File failed. Reading it instead." << std::endl;
+		return parseVOLDataFromFile(VOL_filepath);
+	}
+
+	data.name = std::string(VOL_filepath);
+	data.name = data.name.substr(0, data.name.find_last_of("."));
+
+	if (!parseVOLHeader(mapping->data(), mapping->size(), data)) {
+		std::cerr << "[ERROR] VOL File is truncated or has an invalid header. Loading placeholder." << std::endl;
 
-	data.saved_border = get_int(file_data, 12);
-	
-	data.true_size.z = get_float(file_data, 16);
-	data.true_size.y = get_float(file_data, 20);
-	data.true_size.x = get_float(file_data, 24);
+		load_template(data);
+		return data;
+	}
 
-	data.values = std::vector<unsigned char>(file_data.begin() + 28, file_data.end());
+	size_t payload_size = mapping->size() - VOL_HEADER_SIZE;
+	if (data.voxel_type == VoxelType::UInt8 || NATIVE_BIG_ENDIAN)
+		data.values.view(std::move(mapping), VOL_HEADER_SIZE, payload_size);
+	else
+		data.values = convertVOLPayload(mapping->data() + VOL_HEADER_SIZE, data);
 
 	return data;
 }
\ No newline at end of file
@@ -0,0 +1,318 @@
+#pragma once
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "VOLParser.h"
+#include "Parallel.h"
+
+// levels are halved until none of their sides is larger than this
+const int PYRAMID_COARSEST_SIZE = 32;
+const char PYRAMID_MAGIC[8] = { 'V', 'O', 'L', 'P', 'Y', 'R', '2', '\0' };
+
+enum class PyramidReduction {
+	Average,
+	Maximum
+};
+
+/// <summary>
+/// One level of a pyramid, values holds voxels of the volume's type in native byte order.
+/// </summary>
+struct VOLPyramidLevel {
+	glm::ivec3 resolution = glm::ivec3(0);
+	VoxelType voxel_type = VoxelType::UInt8;
+	std::vector<unsigned char> values;
+
+	size_t dataSize() const {
+		return (size_t)resolution.x * resolution.y * resolution.z * voxelSize(voxel_type);
+	}
+};
+
+/// <summary>
+/// Successively halved copies of a volume. levels[0] is half the full resolution, levels.back() is the coarsest.
+/// </summary>
+struct VOLPyramid {
+	PyramidReduction reduction = PyramidReduction::Average;
+	std::vector<VOLPyramidLevel> levels;
+};
+
+struct VOLThumbnail {
+	int width = 0, height = 0;
+	std::vector<unsigned char> rgba;
+};
+
+template <typename T>
+void reduceTypedVolume(const T* values, glm::ivec3 resolution, PyramidReduction reduction, VOLPyramidLevel& level) {
+	glm::ivec3 out = level.resolution;
+	T* reduced = (T*)level.values.data();
+
+	auto voxel = [&](int x, int y, int z) {
+		x = std::min(x, resolution.x - 1), y = std::min(y, resolution.y - 1), z = std::min(z, resolution.z - 1);
+		return values[((size_t)z * resolution.y + y) * resolution.x + x];
+	};
+
+	parallelFor(0, out.z, [&](size_t z_begin, size_t z_end, unsigned int) {
+		for (size_t z = z_begin; z < z_end; ++z) {
+			for (int y = 0; y < out.y; ++y) {
+				T* row = reduced + (z * out.y + y) * out.x;
+				for (int x = 0; x < out.x; ++x) {
+					T block[8];
+					for (int i = 0; i < 8; ++i)
+						block[i] = voxel(2 * x + (i & 1), 2 * y + ((i >> 1) & 1), 2 * (int)z + (i >> 2));
+					if (reduction == PyramidReduction::Maximum) {
+						row[x] = *std::max_element(block, block + 8);
+					}
+					else if constexpr (std::is_integral_v<T>) {
+						unsigned int sum = 0;
+						for (T value : block)
+							sum += value;
+						row[x] = (T)((sum + 4) / 8);
+					}
+					else {
+						float sum = 0.0f;
+						for (T value : block)
+							sum += value;
+						row[x] = sum / 8.0f;
+					}
+				}
+			}
+		}
+	});
+}
+
+/// <summary>
+/// Halves a volume along every axis by reducing each 2x2x2 block of voxels to one, in parallel over the output slices.
+/// Odd sides round up, the missing voxels of the last block repeat the border.
+/// </summary>
+VOLPyramidLevel reduceVolume(const unsigned char* values, glm::ivec3 resolution, VoxelType voxel_type, PyramidReduction reduction) {
+	VOLPyramidLevel level;
+	level.resolution = (resolution + 1) / 2;
+	level.voxel_type = voxel_type;
+	level.values.resize(level.dataSize());
+	switch (voxel_type) {
+		case VoxelType::UInt8: reduceTypedVolume(values, resolution, reduction, level); break;
+		case VoxelType::UInt16: reduceTypedVolume((const unsigned short*)values, resolution, reduction, level); break;
+		case VoxelType::Float32: reduceTypedVolume((const float*)values, resolution, reduction, level); break;
+	}
+	return level;
+}
+
+/// <summary>
+/// Builds the pyramid of a volume down to a level no larger than PYRAMID_COARSEST_SIZE on any side.
+/// </summary>
+VOLPyramid buildVOLPyramid(const VOLData& data, PyramidReduction reduction = PyramidReduction::Average) {
+	VOLPyramid pyramid;
+	pyramid.reduction = reduction;
+	if (data.values.size() < voxelCount(data) * voxelSize(data.voxel_type))
+		return pyramid;
+
+	const unsigned char* values = data.values.data();
+	glm::ivec3 resolution = data.resolution;
+	while (std::max(resolution.x, std::max(resolution.y, resolution.z)) > PYRAMID_COARSEST_SIZE) {
+		pyramid.levels.push_back(reduceVolume(values, resolution, data.voxel_type, reduction));
+		values = pyramid.levels.back().values.data();
+		resolution = pyramid.levels.back().resolution;
+	}
+	return pyramid;
+}
+
+std::string pyramidCachePath(const std::string& VOL_filepath) {
+	return VOL_filepath + ".pyr";
+}
+
+/// <summary>
+/// Identifies the version of the VOL file a cache was built from, so a changed file invalidates its cache.
+/// </summary>
+bool pyramidSourceStamp(const std::string& VOL_filepath, unsigned long long& size, long long& modified) {
+	std::error_code error;
+	size = std::filesystem::file_size(VOL_filepath, error);
+	if (error)
+		return false;
+	modified = (long long)std::filesystem::last_write_time(VOL_filepath, error).time_since_epoch().count();
+	return !error;
+}
+
+/// <summary>
+/// Writes the pyramid beside the VOL file. The level table comes first so the coarsest level can be read without the rest.
+/// </summary>
+/// <returns>Whether the cache was written, failing is not an error since the cache is only an optimisation.</returns>
+bool writeVOLPyramidCache(const std::string& VOL_filepath, const VOLPyramid& pyramid) {
+	unsigned long long source_size;
+	long long source_modified;
+	if (pyramid.levels.empty() || !pyramidSourceStamp(VOL_filepath, source_size, source_modified))
+		return false;
+
+	// written under a temporary name and renamed, so a concurrent reader never sees a partial cache
+	std::string cache_path = pyramidCachePath(VOL_filepath);
+	std::string temporary_path = cache_path + ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+	std::ofstream cache_fstream(temporary_path, std::ios::binary);
+	if (!cache_fstream)
+		return false;
+
+	int reduction = (int)pyramid.reduction;
+	int voxel_type = (int)pyramid.levels[0].voxel_type;
+	int level_count = (int)pyramid.levels.size();
+	cache_fstream.write(PYRAMID_MAGIC, sizeof(PYRAMID_MAGIC));
+	cache_fstream.write((const char*)&source_size, sizeof(source_size));
+	cache_fstream.write((const char*)&source_modified, sizeof(source_modified));
+	cache_fstream.write((const char*)&reduction, sizeof(reduction));
+	cache_fstream.write((const char*)&voxel_type, sizeof(voxel_type));
+	cache_fstream.write((const char*)&level_count, sizeof(level_count));
+	for (const VOLPyramidLevel& level : pyramid.levels)
+		cache_fstream.write((const char*)&level.resolution[0], 3 * sizeof(int));
+	for (const VOLPyramidLevel& level : pyramid.levels)
+		cache_fstream.write((const char*)level.values.data(), level.values.size());
+
+	bool written = (bool)cache_fstream;
+	cache_fstream.close();
+	std::error_code error;
+	if (written)
+		std::filesystem::rename(temporary_path, cache_path, error);
+	if (!written || error) {
+		std::filesystem::remove(temporary_path, error);
+		return false;
+	}
+	return true;
+}
+
+/// <summary>
+/// Reads levels of the cached pyramid of a VOL file, if there is a cache and it matches the current file.
+/// </summary>
+/// <param name="VOL_filepath">The VOL file whose cache is read.</param>
+/// <param name="pyramid">Receives the levels, levels that are not read stay empty apart from their resolution.</param>
+/// <param name="coarsest_only">Reads just the coarsest level, which is all that is needed for a preview.</param>
+/// <returns>Whether a valid cache was read.</returns>
+bool readVOLPyramidCache(const std::string& VOL_filepath, VOLPyramid& pyramid, bool coarsest_only = false) {
+	unsigned long long source_size, cached_size;
+	long long source_modified, cached_modified;
+	if (!pyramidSourceStamp(VOL_filepath, source_size, source_modified))
+		return false;
+
+	std::ifstream cache_fstream(pyramidCachePath(VOL_filepath), std::ios::binary);
+	if (!cache_fstream)
+		return false;
+
+	char magic[sizeof(PYRAMID_MAGIC)];
+	int reduction, voxel_type, level_count;
+	cache_fstream.read(magic, sizeof(magic));
+	cache_fstream.read((char*)&cached_size, sizeof(cached_size));
+	cache_fstream.read((char*)&cached_modified, sizeof(cached_modified));
+	cache_fstream.read((char*)&reduction, sizeof(reduction));
+	cache_fstream.read((char*)&voxel_type, sizeof(voxel_type));
+	cache_fstream.read((char*)&level_count, sizeof(level_count));
+	if (!cache_fstream || std::memcmp(magic, PYRAMID_MAGIC, sizeof(magic)) != 0 ||
+		cached_size != source_size || cached_modified != source_modified ||
+		voxel_type < (int)VoxelType::UInt8 || voxel_type > (int)VoxelType::Float32 || level_count <= 0 || level_count > 32)
+		return false;
+
+	pyramid.reduction = (PyramidReduction)reduction;
+	pyramid.levels.assign(level_count, VOLPyramidLevel());
+	std::streamoff data_offset = 0;
+	for (VOLPyramidLevel& level : pyramid.levels) {
+		level.voxel_type = (VoxelType)voxel_type;
+		cache_fstream.read((char*)&level.resolution[0], 3 * sizeof(int));
+		if (!cache_fstream || level.resolution.x <= 0 || level.resolution.y <= 0 || level.resolution.z <= 0)
+			return false;
+	}
+	std::streamoff levels_begin = cache_fstream.tellg();
+
+	for (int i = 0; i < level_count; ++i) {
+		VOLPyramidLevel& level = pyramid.levels[i];
+		size_t level_size = level.dataSize();
+		if (!coarsest_only || i + 1 == level_count) {
+			level.values.resize(level_size);
+			cache_fstream.seekg(levels_begin + data_offset);
+			if (!cache_fstream.read((char*)level.values.data(), level_size))
+				return false;
+		}
+		data_offset += (std::streamoff)level_size;
+	}
+	return true;
+}
+
+/// <summary>
+/// Wraps a pyramid level as a volume that can be rendered in place of the full resolution one.
+/// </summary>
+VOLData pyramidLevelAsVOLData(const VOLData& source, const VOLPyramidLevel& level) {
+	VOLData data;
+	data.name = source.name;
+	data.resolution = level.resolution;
+	data.saved_border = source.saved_border;
+	data.true_size = source.true_size;
+	data.voxel_type = level.voxel_type;
+	data.values = level.values;
+	return data;
+}
+
+template <typename T>
+void projectTypedVolume(const VOLPyramidLevel& level, VOLThumbnail& thumbnail) {
+	const T* values = (const T*)level.values.data();
+	size_t voxel_count = (size_t)level.resolution.x * level.resolution.y * level.resolution.z;
+	// 16 bit and float volumes are scaled by their own range, so the thumbnail shows something even for narrow ranges
+	T low = *std::min_element(values, values + voxel_count), high = *std::max_element(values, values + voxel_count);
+	float scale = high > low ? 255.0f / ((float)high - (float)low) : 0.0f;
+	if constexpr (sizeof(T) == 1) {
+		low = 0;
+		scale = 1.0f;
+	}
+
+	for (int y = 0; y < level.resolution.y; ++y) {
+		for (int x = 0; x < level.resolution.x; ++x) {
+			T brightest = values[(size_t)y * level.resolution.x + x];
+			for (int z = 1; z < level.resolution.z; ++z)
+				brightest = std::max(brightest, values[((size_t)z * level.resolution.y + y) * level.resolution.x + x]);
+			// flip vertically so y points up like in the renderer
+			unsigned char* pixel = &thumbnail.rgba[(((size_t)(level.resolution.y - 1 - y)) * thumbnail.width + x) * 4];
+			pixel[0] = pixel[1] = pixel[2] = (unsigned char)std::clamp(((float)brightest - (float)low) * scale, 0.0f, 255.0f);
+		}
+	}
+}
+
+/// <summary>
+/// Renders a maximum intensity projection of a pyramid level along z as a grayscale image.
+/// </summary>
+VOLThumbnail computeVOLThumbnail(const VOLPyramidLevel& level) {
+	VOLThumbnail thumbnail;
+	if (level.values.size() < level.dataSize() || level.dataSize() == 0)
+		return thumbnail;
+	thumbnail.width = level.resolution.x;
+	thumbnail.height = level.resolution.y;
+	thumbnail.rgba.assign((size_t)thumbnail.width * thumbnail.height * 4, 255);
+	switch (level.voxel_type) {
+		case VoxelType::UInt8: projectTypedVolume<unsigned char>(level, thumbnail); break;
+		case VoxelType::UInt16: projectTypedVolume<unsigned short>(level, thumbnail); break;
+		case VoxelType::Float32: projectTypedVolume<float>(level, thumbnail); break;
+	}
+	return thumbnail;
+}
+
+/// <summary>
+/// Produces the thumbnail of a VOL file from its cached pyramid, building and caching the pyramid first if needed.
+/// </summary>
+VOLThumbnail loadVOLThumbnail(const std::string& VOL_filepath) {
+	VOLPyramid pyramid;
+	if (readVOLPyramidCache(VOL_filepath, pyramid, true))
+		return computeVOLThumbnail(pyramid.levels.back());
+
+	if (!std::filesystem::is_regular_file(VOL_filepath))
+		return VOLThumbnail();
+	VOLData data = parseVOLDataFromMappedFile(VOL_filepath.c_str());
+	pyramid = buildVOLPyramid(data);
+	writeVOLPyramidCache(VOL_filepath, pyramid);
+	if (!pyramid.levels.empty())
+		return computeVOLThumbnail(pyramid.levels.back());
+
+	// small volumes have no reduced levels, project the volume itself
+	VOLPyramidLevel full;
+	full.resolution = data.resolution;
+	full.voxel_type = data.voxel_type;
+	full.values.assign(data.values.begin(), data.values.begin() + std::min(data.values.size(), full.dataSize()));
+	return computeVOLThumbnail(full);
+}
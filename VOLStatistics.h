@@ -0,0 +1,370 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VOL_STATISTICS_SSE2 1
+#endif
+
+#include "VOLParser.h"
+#include "Parallel.h"
+#include "VOLBrickReader.h"
+
+/// <summary>
+/// The range of voxel values the transfer function spans, which the histogram bins cover as well.
+/// Integer types span their whole range, floats span the range of the volume.
+/// </summary>
+glm::vec2 transferFunctionDomain(VoxelType type, float min_value, float max_value) {
+	switch (type) {
+		case VoxelType::UInt8: return glm::vec2(0.0f, 255.0f);
+		case VoxelType::UInt16: return glm::vec2(0.0f, 65535.0f);
+		case VoxelType::Float32: return max_value > min_value ? glm::vec2(min_value, max_value) : glm::vec2(min_value, min_value + 1.0f);
+	}
+	return glm::vec2(0.0f, 1.0f);
+}
+
+glm::vec2 transferFunctionDomain(const VOLData& data) {
+	return transferFunctionDomain(data.voxel_type, data.statistics.min_value, data.statistics.max_value);
+}
+
+/// <summary>
+/// Partial statistics over a set of rows, merged across threads at the end of the pass.
+/// </summary>
+struct VOLStatisticsAccumulator {
+	double min_value = std::numeric_limits<double>::max(), max_value = std::numeric_limits<double>::lowest();
+	double sum = 0.0, sum_of_squares = 0.0;
+	unsigned long long zeros = 0;
+	std::vector<unsigned long long> histogram = std::vector<unsigned long long>(256);
+	glm::ivec3 nonzero_min = glm::ivec3(std::numeric_limits<int>::max()), nonzero_max = glm::ivec3(-1);
+
+	void merge(const VOLStatisticsAccumulator& other) {
+		min_value = std::min(min_value, other.min_value);
+		max_value = std::max(max_value, other.max_value);
+		sum += other.sum;
+		sum_of_squares += other.sum_of_squares;
+		zeros += other.zeros;
+		for (int i = 0; i < 256; ++i)
+			histogram[i] += other.histogram[i];
+		nonzero_min = glm::min(nonzero_min, other.nonzero_min);
+		nonzero_max = glm::max(nonzero_max, other.nonzero_max);
+	}
+
+	void addHistogram(const unsigned int (&counts)[4][256]) {
+		for (int i = 0; i < 256; ++i)
+			histogram[i] += (unsigned long long)counts[0][i] + counts[1][i] + counts[2][i] + counts[3][i];
+	}
+};
+
+/// <summary>
+/// Accumulates min, max, sum, sum of squares and zero count of one row of 8 bit voxels, 16 at a time where SSE2 is available.
+/// </summary>
+void accumulateRowMoments(const unsigned char* row, size_t length, VOLStatisticsAccumulator& acc) {
+	size_t x = 0;
+	unsigned int min_value = 255, max_value = 0;
+	unsigned long long sum = 0, sum_of_squares = 0, zeros = 0;
+#ifdef VOL_STATISTICS_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	__m128i vmin = _mm_set1_epi8((char)0xFF), vmax = zero;
+	__m128i vsum = zero, vzeros = zero;
+	while (x + 16 <= length) {
+		// the 32 bit square sums and 8 bit zero counters are flushed before they can overflow
+		size_t block_end = std::min(length - length % 16, x + 16 * 255);
+		__m128i vsquares = zero, vzero_bytes = zero;
+		for (; x < block_end; x += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i*)(row + x));
+			vmin = _mm_min_epu8(vmin, v);
+			vmax = _mm_max_epu8(vmax, v);
+			vsum = _mm_add_epi64(vsum, _mm_sad_epu8(v, zero));
+			__m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+			vsquares = _mm_add_epi32(vsquares, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+			vzero_bytes = _mm_sub_epi8(vzero_bytes, _mm_cmpeq_epi8(v, zero));
+		}
+		vzeros = _mm_add_epi64(vzeros, _mm_sad_epu8(vzero_bytes, zero));
+		alignas(16) unsigned int squares[4];
+		_mm_store_si128((__m128i*)squares, vsquares);
+		sum_of_squares += (unsigned long long)squares[0] + squares[1] + squares[2] + squares[3];
+	}
+	alignas(16) unsigned char mins[16], maxs[16];
+	alignas(16) unsigned long long sums[2], zero_counts[2];
+	_mm_store_si128((__m128i*)mins, vmin);
+	_mm_store_si128((__m128i*)maxs, vmax);
+	_mm_store_si128((__m128i*)sums, vsum);
+	_mm_store_si128((__m128i*)zero_counts, vzeros);
+	if (x > 0) {
+		for (int i = 0; i < 16; ++i) {
+			min_value = std::min<unsigned int>(min_value, mins[i]);
+			max_value = std::max<unsigned int>(max_value, maxs[i]);
+		}
+	}
+	sum += sums[0] + sums[1];
+	zeros += zero_counts[0] + zero_counts[1];
+#endif
+	for (; x < length; ++x) {
+		unsigned int value = row[x];
+		min_value = std::min(min_value, value);
+		max_value = std::max(max_value, value);
+		sum += value;
+		sum_of_squares += value * value;
+		zeros += value == 0;
+	}
+	acc.min_value = std::min(acc.min_value, (double)min_value);
+	acc.max_value = std::max(acc.max_value, (double)max_value);
+	acc.sum += (double)sum;
+	acc.sum_of_squares += (double)sum_of_squares;
+	acc.zeros += zeros;
+}
+
+/// <summary>
+/// Accumulates the moments of one row of 16 bit or float voxels, written so the compiler can vectorize it.
+/// </summary>
+template <typename T>
+void accumulateRowMoments(const T* row, size_t length, VOLStatisticsAccumulator& acc) {
+	T min_value = row[0], max_value = row[0];
+	double sum = 0.0, sum_of_squares = 0.0;
+	unsigned long long zeros = 0;
+	for (size_t x = 0; x < length; ++x) {
+		T value = row[x];
+		min_value = std::min(min_value, value);
+		max_value = std::max(max_value, value);
+		sum += (double)value;
+		sum_of_squares += (double)value * value;
+		zeros += value == 0;
+	}
+	acc.min_value = std::min(acc.min_value, (double)min_value);
+	acc.max_value = std::max(acc.max_value, (double)max_value);
+	acc.sum += sum;
+	acc.sum_of_squares += sum_of_squares;
+	acc.zeros += zeros;
+}
+
+/// <summary>
+/// Adds one row of voxels to the histogram, spread over four sub-histograms to avoid stalling on repeated values.
+/// </summary>
+/// <param name="bin">Maps a voxel value to its bin.</param>
+template <typename T, typename Binning>
+void accumulateRowHistogram(const T* row, size_t length, unsigned int (&counts)[4][256], Binning bin) {
+	size_t x = 0;
+	for (; x + 4 <= length; x += 4) {
+		++counts[0][bin(row[x])];
+		++counts[1][bin(row[x + 1])];
+		++counts[2][bin(row[x + 2])];
+		++counts[3][bin(row[x + 3])];
+	}
+	for (; x < length; ++x)
+		++counts[0][bin(row[x])];
+}
+
+/// <summary>
+/// Accumulates one row of voxels that starts at voxel coordinates row_origin.
+/// </summary>
+/// <param name="domain">The value range the histogram spans, see transferFunctionDomain.</param>
+template <typename T>
+void accumulateRow(const T* row, size_t length, glm::ivec3 row_origin, glm::vec2 domain, VOLStatisticsAccumulator& acc, unsigned int (&counts)[4][256]) {
+	unsigned long long zeros_before = acc.zeros;
+	accumulateRowMoments(row, length, acc);
+	if constexpr (sizeof(T) == 1) {
+		accumulateRowHistogram(row, length, counts, [](T value) { return value; });
+	}
+	else if constexpr (std::is_integral_v<T>) {
+		accumulateRowHistogram(row, length, counts, [](T value) { return value >> 8; });
+	}
+	else {
+		float scale = 256.0f / (domain.y - domain.x);
+		accumulateRowHistogram(row, length, counts, [&](T value) { return std::clamp((int)((value - domain.x) * scale), 0, 255); });
+	}
+
+	if (acc.zeros - zeros_before == length)
+		return;
+	// the row has non-zero voxels, find how far they extend along x
+	size_t first = 0, last = length - 1;
+	while (row[first] == 0) ++first;
+	while (row[last] == 0) --last;
+	acc.nonzero_min = glm::min(acc.nonzero_min, row_origin + glm::ivec3((int)first, 0, 0));
+	acc.nonzero_max = glm::max(acc.nonzero_max, row_origin + glm::ivec3((int)last, 0, 0));
+}
+
+/// <summary>
+/// Merges the per thread partial results into the final statistics.
+/// </summary>
+void finalizeVOLStatistics(const std::vector<VOLStatisticsAccumulator>& partials, size_t voxel_count, VOLStatistics& stats) {
+	VOLStatisticsAccumulator total;
+	for (const VOLStatisticsAccumulator& partial : partials)
+		total.merge(partial);
+
+	stats.min_value = (float)total.min_value;
+	stats.max_value = (float)total.max_value;
+	stats.mean = total.sum / (double)voxel_count;
+	stats.variance = std::max(0.0, total.sum_of_squares / (double)voxel_count - stats.mean * stats.mean);
+	stats.histogram = total.histogram;
+	if (total.zeros == voxel_count) {
+		stats.nonzero_min = glm::ivec3(0);
+		stats.nonzero_max = glm::ivec3(-1);
+	}
+	else {
+		stats.nonzero_min = total.nonzero_min;
+		stats.nonzero_max = total.nonzero_max;
+	}
+	stats.empty_fraction = total.zeros / (double)voxel_count;
+	stats.computed = true;
+}
+
+/// <summary>
+/// Merges per thread (min, max) pairs.
+/// </summary>
+glm::vec2 mergeValueRanges(const std::vector<glm::vec2>& partials) {
+	glm::vec2 range = partials[0];
+	for (const glm::vec2& partial : partials)
+		range = glm::vec2(std::min(range.x, partial.x), std::max(range.y, partial.y));
+	return range;
+}
+
+/// <summary>
+/// Finds the range of float voxels, which the histogram needs before it can bin them.
+/// </summary>
+glm::vec2 floatValueRange(const float* values, size_t count) {
+	std::vector<glm::vec2> partials(parallelThreadCount(), glm::vec2(std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest()));
+	parallelFor(0, count, [&](size_t begin, size_t end, unsigned int thread_index) {
+		float min_value = partials[thread_index].x, max_value = partials[thread_index].y;
+		for (size_t i = begin; i < end; ++i) {
+			min_value = std::min(min_value, values[i]);
+			max_value = std::max(max_value, values[i]);
+		}
+		partials[thread_index] = glm::vec2(min_value, max_value);
+	});
+	return mergeValueRanges(partials);
+}
+
+template <typename T>
+bool computeTypedVOLStatistics(VOLData& data, const std::function<bool(float)>& report) {
+	size_t row_length = (size_t)data.resolution.x;
+	size_t rows_per_slice = (size_t)data.resolution.y;
+	size_t slices = (size_t)data.resolution.z;
+	size_t voxel_count = voxelCount(data);
+	if (voxel_count == 0 || data.values.size() < voxel_count * sizeof(T))
+		return false;
+
+	const T* values = (const T*)data.values.data();
+	glm::vec2 domain(0.0f);
+	if constexpr (std::is_floating_point_v<T>) {
+		glm::vec2 range = floatValueRange(values, voxel_count);
+		domain = transferFunctionDomain(data.voxel_type, range.x, range.y);
+	}
+
+	std::vector<VOLStatisticsAccumulator> partials(parallelThreadCount());
+	std::atomic<size_t> slices_done{ 0 };
+	std::atomic<bool> cancelled{ false };
+
+	parallelFor(0, slices, [&](size_t z_begin, size_t z_end, unsigned int thread_index) {
+		VOLStatisticsAccumulator& acc = partials[thread_index];
+		// 32 bit counts are flushed every slice, a slice has far fewer than 2^32 voxels
+		unsigned int counts[4][256];
+		for (size_t z = z_begin; z < z_end && !cancelled; ++z) {
+			std::fill(&counts[0][0], &counts[0][0] + 4 * 256, 0u);
+			for (size_t y = 0; y < rows_per_slice; ++y) {
+				const T* row = values + (z * rows_per_slice + y) * row_length;
+				accumulateRow(row, row_length, glm::ivec3(0, (int)y, (int)z), domain, acc, counts);
+			}
+			acc.addHistogram(counts);
+
+			size_t done = ++slices_done;
+			if (report && !report(done / (float)slices))
+				cancelled = true;
+		}
+	});
+
+	if (cancelled)
+		return false;
+
+	finalizeVOLStatistics(partials, voxel_count, data.statistics);
+	return true;
+}
+
+/// <summary>
+/// Computes the statistics of the volume in a single multithreaded pass over its values and caches them on the VOLData.
+/// Float volumes take a second, cheaper pass first to find the range the histogram is binned over.
+/// </summary>
+/// <param name="data">The volume, data.statistics receives the result.</param>
+/// <param name="report">Optional, called from the worker threads with the fraction done, returning false cancels the pass.</param>
+/// <returns>False if the pass was cancelled, in which case data.statistics is left untouched.</returns>
+bool computeVOLStatistics(VOLData& data, const std::function<bool(float)>& report = nullptr) {
+	switch (data.voxel_type) {
+		case VoxelType::UInt8: return computeTypedVOLStatistics<unsigned char>(data, report);
+		case VoxelType::UInt16: return computeTypedVOLStatistics<unsigned short>(data, report);
+		case VoxelType::Float32: return computeTypedVOLStatistics<float>(data, report);
+	}
+	return false;
+}
+
+template <typename T>
+bool computeTypedVOLStatisticsFromBricks(VOLBrickReader& reader, VOLStatistics& stats) {
+	size_t voxel_count = voxelCount(reader.header);
+	std::vector<VOLStatisticsAccumulator> partials(parallelThreadCount());
+
+	glm::vec2 domain(0.0f);
+	if constexpr (std::is_floating_point_v<T>) {
+		// streaming twice is cheaper than holding a float volume that does not fit into memory
+		std::vector<glm::vec2> ranges(parallelThreadCount(), glm::vec2(std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest()));
+		bool completed = reader.forEachBrick([&](const VOLBrick& brick, unsigned int thread_index) {
+			glm::vec2& range = ranges[thread_index];
+			for (int z = 0; z < brick.size.z; ++z) {
+				for (int y = 0; y < brick.size.y; ++y) {
+					for (int x = 0; x < brick.size.x; ++x) {
+						float value = brick.at<float>(x, y, z);
+						range = glm::vec2(std::min(range.x, value), std::max(range.y, value));
+					}
+				}
+			}
+			return true;
+		});
+		if (!completed)
+			return false;
+		glm::vec2 range = mergeValueRanges(ranges);
+		domain = transferFunctionDomain(reader.header.voxel_type, range.x, range.y);
+	}
+
+	bool completed = reader.forEachBrick([&](const VOLBrick& brick, unsigned int thread_index) {
+		VOLStatisticsAccumulator& acc = partials[thread_index];
+		unsigned int counts[4][256] = {};
+		for (int z = 0; z < brick.size.z; ++z) {
+			for (int y = 0; y < brick.size.y; ++y)
+				accumulateRow(&brick.at<T>(0, y, z), brick.size.x, brick.origin + glm::ivec3(0, y, z), domain, acc, counts);
+		}
+		acc.addHistogram(counts);
+		return true;
+	});
+	if (!completed)
+		return false;
+
+	finalizeVOLStatistics(partials, voxel_count, stats);
+	return true;
+}
+
+/// <summary>
+/// Computes the same statistics as computeVOLStatistics while streaming the file brick by brick,
+/// for volumes too large to be held in memory.
+/// </summary>
+/// <param name="reader">An opened brick reader, its ghost voxels are skipped.</param>
+/// <param name="stats">Receives the result.</param>
+/// <returns>False if the file could not be read.</returns>
+bool computeVOLStatisticsFromBricks(VOLBrickReader& reader, VOLStatistics& stats) {
+	switch (reader.header.voxel_type) {
+		case VoxelType::UInt8: return computeTypedVOLStatisticsFromBricks<unsigned char>(reader, stats);
+		case VoxelType::UInt16: return computeTypedVOLStatisticsFromBricks<unsigned short>(reader, stats);
+		case VoxelType::Float32: return computeTypedVOLStatisticsFromBricks<float>(reader, stats);
+	}
+	return false;
+}
+
+/// <summary>
+/// Returns the cached statistics of the volume, computing them first if this has not happened yet.
+/// </summary>
+const VOLStatistics& getVOLStatistics(VOLData& data) {
+	if (!data.statistics.computed)
+		computeVOLStatistics(data);
+	return data.statistics;
+}
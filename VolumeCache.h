@@ -0,0 +1,219 @@
+#pragma once
+#include <filesystem>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+
+#include "BrickedVolume.h"
+#include "MacrocellGrid.h"
+#include "VOLParser.h"
+
+/// <summary>
+/// Identifies one version of a VOL file, a file that changed on disk gets a new key.
+/// </summary>
+struct VolumeKey {
+	std::string path;
+	unsigned long long size = 0;
+	long long modified = 0;
+
+	bool operator==(const VolumeKey& other) const {
+		return path == other.path && size == other.size && modified == other.modified;
+	}
+};
+
+/// <summary>
+/// Builds the key of the current version of a VOL file.
+/// </summary>
+/// <returns>False if the file does not exist.</returns>
+bool volumeKey(const std::string& VOL_filepath, VolumeKey& key) {
+	std::error_code error;
+	key.path = VOL_filepath;
+	key.size = std::filesystem::file_size(VOL_filepath, error);
+	if (error)
+		return false;
+	key.modified = (long long)std::filesystem::last_write_time(VOL_filepath, error).time_since_epoch().count();
+	return !error;
+}
+
+/// <summary>
+/// Keeps the most recently used entries up to a budget of bytes, evicting the least recently used ones first.
+/// Not thread safe, see HostVolumeCache for the version shared with the loader thread.
+/// </summary>
+template <typename T>
+class ResidencyLRU {
+	public:
+		struct Entry {
+			VolumeKey key;
+			T value;
+			size_t bytes = 0;
+		};
+
+		// called with every entry that is evicted or cleared, e.g. to free its GPU memory
+		std::function<void(Entry&)> on_evict;
+
+		explicit ResidencyLRU(size_t budget_bytes) : budget(budget_bytes) {}
+
+		ResidencyLRU(const ResidencyLRU&) = delete;
+		ResidencyLRU& operator=(const ResidencyLRU&) = delete;
+
+		~ResidencyLRU() {
+			clear();
+		}
+
+		/// <summary>
+		/// Looks up an entry and marks it as the most recently used.
+		/// </summary>
+		/// <returns>The entry, or nullptr when it is not resident.</returns>
+		Entry* find(const VolumeKey& key) {
+			for (auto it = entries.begin(); it != entries.end(); ++it) {
+				if (it->key == key) {
+					entries.splice(entries.begin(), entries, it);
+					return &entries.front();
+				}
+			}
+			return nullptr;
+		}
+
+		bool contains(const VolumeKey& key) const {
+			for (const Entry& entry : entries)
+				if (entry.key == key)
+					return true;
+			return false;
+		}
+
+		/// <summary>
+		/// Inserts an entry as the most recently used, replacing an older version of the same path,
+		/// then evicts the least recently used entries until the budget is met. The new entry itself is never evicted.
+		/// </summary>
+		void insert(const VolumeKey& key, T value, size_t bytes) {
+			for (auto it = entries.begin(); it != entries.end();) {
+				if (it->key.path == key.path)
+					it = evict(it);
+				else
+					++it;
+			}
+			entries.push_front(Entry{ key, std::move(value), bytes });
+			usage += bytes;
+			while (usage > budget && entries.size() > 1)
+				evict(std::prev(entries.end()));
+		}
+
+		/// <summary>
+		/// Evicts the least recently used entry to make room elsewhere, sparing the most recently used one.
+		/// </summary>
+		/// <returns>Whether an entry was evicted.</returns>
+		bool evictLeastRecent() {
+			if (entries.size() <= 1)
+				return false;
+			evict(std::prev(entries.end()));
+			return true;
+		}
+
+		void setBudget(size_t budget_bytes) {
+			budget = budget_bytes;
+			while (usage > budget && entries.size() > 1)
+				evict(std::prev(entries.end()));
+		}
+
+		void clear() {
+			while (!entries.empty())
+				evict(entries.begin());
+		}
+
+		size_t budgetBytes() const {
+			return budget;
+		}
+
+		size_t usedBytes() const {
+			return usage;
+		}
+
+		size_t count() const {
+			return entries.size();
+		}
+
+	private:
+		// most recently used first
+		std::list<Entry> entries;
+		size_t budget;
+		size_t usage = 0;
+
+		typename std::list<Entry>::iterator evict(typename std::list<Entry>::iterator it) {
+			if (on_evict)
+				on_evict(*it);
+			usage -= it->bytes;
+			return entries.erase(it);
+		}
+};
+
+/// <summary>
+/// Parsed volumes with their statistics kept in host memory, shared by the loader thread and the render thread.
+/// Copies of a VOLData share its voxels, so handing out a cached volume costs no voxel copies.
+/// </summary>
+class HostVolumeCache {
+	public:
+		explicit HostVolumeCache(size_t budget_bytes) : cache(budget_bytes) {}
+
+		bool find(const VolumeKey& key, VOLData& data) {
+			std::lock_guard<std::mutex> lock(mutex);
+			ResidencyLRU<VOLData>::Entry* entry = cache.find(key);
+			if (entry == nullptr)
+				return false;
+			data = entry->value;
+			return true;
+		}
+
+		bool contains(const VolumeKey& key) {
+			std::lock_guard<std::mutex> lock(mutex);
+			return cache.contains(key);
+		}
+
+		/// <summary>
+		/// Caches a completely loaded volume. Volumes larger than the whole budget are not cached.
+		/// Voxels that are a view of the file are copied, an entry must not keep the file mapped and open.
+		/// </summary>
+		void insert(const VolumeKey& key, const VOLData& data) {
+			size_t bytes = data.values.size() + data.gradients.size() + (data.bricks ? data.bricks->pool.size() : 0) +
+			(data.macrocells ? data.macrocells->ranges.size() * sizeof(glm::vec2) : 0);
+			if (bytes > budgetBytes())
+				return;
+			VOLData cached = data;
+			if (cached.values.isMapped())
+				cached.values = std::vector<unsigned char>(data.values.begin(), data.values.end());
+			std::lock_guard<std::mutex> lock(mutex);
+			cache.insert(key, cached, bytes);
+		}
+
+		void setBudget(size_t budget_bytes) {
+			std::lock_guard<std::mutex> lock(mutex);
+			cache.setBudget(budget_bytes);
+		}
+
+		size_t budgetBytes() {
+			std::lock_guard<std::mutex> lock(mutex);
+			return cache.budgetBytes();
+		}
+
+		size_t usedBytes() {
+			std::lock_guard<std::mutex> lock(mutex);
+			return cache.usedBytes();
+		}
+
+	private:
+		std::mutex mutex;
+		ResidencyLRU<VOLData> cache;
+};
+
+/// <summary>
+/// A volume resident on the GPU: its texture and its VOLData without the voxels.
+/// The texture of a bricked volume is its brick pool, which is sampled through the page table.
+/// The gradient texture, if any, is laid out like the volume texture.
+/// </summary>
+struct GPUVolume {
+	unsigned int texture = 0;
+	unsigned int page_table = 0;
+	unsigned int gradients = 0;
+	BrickLayout bricks;
+	VOLData header;
+};
@@ -0,0 +1,403 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MacrocellGrid.h"
+#include "VOLGradients.h"
+#include "VOLParser.h"
+#include "VOLStatistics.h"
+#include "VOLPyramid.h"
+#include "Resample.h"
+#include "VolumeCache.h"
+
+enum class LoadStage {
+	Idle,
+	Waiting,
+	Mapping,
+	Resampling,
+	Statistics,
+	Pyramid,
+	Gradients,
+	Bricking,
+	Ready,
+	Failed
+};
+
+const char* loadStageName(LoadStage stage) {
+	switch (stage) {
+		case LoadStage::Idle: return "Idle";
+		case LoadStage::Waiting: return "Waiting";
+		case LoadStage::Mapping: return "Mapping";
+		case LoadStage::Resampling: return "Resampling";
+		case LoadStage::Statistics: return "Statistics";
+		case LoadStage::Pyramid: return "Pyramid";
+		case LoadStage::Gradients: return "Gradients";
+		case LoadStage::Bricking: return "Bricking";
+		case LoadStage::Ready: return "Ready";
+		case LoadStage::Failed: return "Failed";
+	}
+	return "";
+}
+
+/// <summary>
+/// Loads volumes on a worker thread so the render thread never blocks on the disk.
+/// Each request supersedes the previous one, a request still waiting out its delay or in flight is cancelled.
+/// The render thread calls poll() every frame and swaps in the volume once it is ready.
+/// When the volume has a cached pyramid, its coarsest level is handed over first as a preview.
+/// Completed volumes are kept in the host cache, and while there is no request the worker prefetches into it.
+/// Volumes that are anisotropic or do not fit the budget are resampled before their statistics and gradients are computed,
+/// sparse volumes are handed over as their non-empty bricks without their dense voxels.
+/// </summary>
+class VolumeLoader {
+	public:
+		HostVolumeCache cache;
+
+		explicit VolumeLoader(size_t host_cache_budget, ResampleBudget resample_budget = ResampleBudget()) :
+			cache(host_cache_budget), budget(resample_budget) {
+			worker = std::thread(&VolumeLoader::run, this);
+		}
+
+		VolumeLoader(const VolumeLoader&) = delete;
+		VolumeLoader& operator=(const VolumeLoader&) = delete;
+
+		~VolumeLoader() {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+				++generation;
+			}
+			wake.notify_all();
+			worker.join();
+		}
+
+		/// <summary>
+		/// Requests a volume to be loaded, cancelling any request that has not completed yet.
+		/// </summary>
+		/// <param name="VOL_filepath">The path of the VOL file.</param>
+		/// <param name="delay">Seconds to wait before starting, so that requests made while typing a path are coalesced.</param>
+		void request(const std::string& VOL_filepath, double delay = 0.0) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				pending_path = VOL_filepath;
+				has_request = true;
+				start_time = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(delay));
+				++generation;
+				has_result = false;
+				stage = LoadStage::Waiting;
+				progress = 0.0f;
+			}
+			wake.notify_all();
+		}
+
+		/// <summary>
+		/// Cancels the current request, e.g. because the render thread switched to a volume it already had on the GPU.
+		/// </summary>
+		void cancel() {
+			std::lock_guard<std::mutex> lock(mutex);
+			has_request = false;
+			++generation;
+			has_result = false;
+			stage = LoadStage::Idle;
+		}
+
+		/// <summary>
+		/// Queues volumes to be loaded into the host cache while the worker has nothing else to do.
+		/// Requests take priority and interrupt a prefetch in progress.
+		/// </summary>
+		void prefetch(const std::vector<std::string>& VOL_filepaths) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				prefetch_queue.insert(prefetch_queue.end(), VOL_filepaths.begin(), VOL_filepaths.end());
+			}
+			wake.notify_all();
+		}
+
+		/// <summary>
+		/// Hands over the most recently completed volume or preview, if there is one that has not been handed over yet.
+		/// A preview can be told apart from the complete volume by its statistics, which are not computed yet.
+		/// </summary>
+		/// <param name="data">Receives the loaded volume.</param>
+		/// <param name="key">Optional, receives the key of the file the volume was loaded from.</param>
+		/// <returns>Whether a new volume was handed over.</returns>
+		bool poll(VOLData& data, VolumeKey* key = nullptr) {
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!has_result)
+				return false;
+			data = std::move(result);
+			result = VOLData();
+			if (key != nullptr)
+				*key = result_key;
+			has_result = false;
+			// the worker goes on to the complete volume after a preview, so the load is still in progress
+			if (!result_preview)
+				stage = LoadStage::Idle;
+			return true;
+		}
+
+		bool busy() const {
+			LoadStage current = stage;
+			return current == LoadStage::Waiting || current == LoadStage::Mapping || current == LoadStage::Resampling || current == LoadStage::Statistics || current == LoadStage::Pyramid ||
+				current == LoadStage::Gradients || current == LoadStage::Bricking;
+		}
+
+		LoadStage currentStage() const {
+			return stage;
+		}
+
+		float currentProgress() const {
+			return progress;
+		}
+
+		std::string currentStatus() {
+			std::lock_guard<std::mutex> lock(mutex);
+			return status;
+		}
+
+		/// <summary>
+		/// The resolution the last requested volume was loaded at and why, e.g. "512x512x90 -> 512x512x225 (Lanczos, isotropic)".
+		/// </summary>
+		std::string resampleSummary() {
+			std::lock_guard<std::mutex> lock(mutex);
+			return resample_summary;
+		}
+
+	private:
+		std::thread worker;
+		std::mutex mutex;
+		std::condition_variable wake;
+		const ResampleBudget budget;
+
+		std::string pending_path;
+		std::chrono::steady_clock::time_point start_time;
+		bool has_request = false;
+		bool stopping = false;
+
+		std::deque<std::string> prefetch_queue;
+
+		VOLData result;
+		VolumeKey result_key;
+		bool has_result = false, result_preview = false;
+		std::string status;
+		std::string resample_summary;
+
+		std::atomic<unsigned int> generation{ 0 };
+		std::atomic<LoadStage> stage{ LoadStage::Idle };
+		std::atomic<float> progress{ 0.0f };
+
+		bool cancelled(unsigned int request_generation) const {
+			return generation != request_generation;
+		}
+
+		void finish(unsigned int request_generation, LoadStage final_stage, std::string final_status) {
+			std::lock_guard<std::mutex> lock(mutex);
+			if (cancelled(request_generation))
+				return;
+			stage = final_stage;
+			status = std::move(final_status);
+			progress = 1.0f;
+		}
+
+		void run() {
+			while (true) {
+				std::string VOL_filepath;
+				unsigned int request_generation;
+				bool prefetching = false;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					// wait for a request, then wait out its delay unless it is superseded meanwhile,
+					// prefetching only while there is no request at all
+					while (!stopping && (!has_request || std::chrono::steady_clock::now() < start_time)) {
+						if (!has_request && !prefetch_queue.empty())
+							break;
+						if (has_request)
+							wake.wait_until(lock, start_time);
+						else
+							wake.wait(lock);
+					}
+					if (stopping)
+						return;
+					request_generation = generation;
+					if (has_request) {
+						VOL_filepath = pending_path;
+						has_request = false;
+						status = VOL_filepath;
+					}
+					else {
+						VOL_filepath = prefetch_queue.front();
+						prefetch_queue.pop_front();
+						prefetching = true;
+					}
+				}
+
+				if (prefetching)
+					prefetchVolume(VOL_filepath, request_generation);
+				else
+					load(VOL_filepath, request_generation);
+			}
+		}
+
+		void load(const std::string& VOL_filepath, unsigned int request_generation) {
+			if (cancelled(request_generation))
+				return;
+			stage = LoadStage::Mapping;
+			VolumeKey key;
+			if (!volumeKey(VOL_filepath, key) || !std::filesystem::is_regular_file(VOL_filepath)) {
+				finish(request_generation, LoadStage::Failed, "File not found: " + VOL_filepath);
+				return;
+			}
+
+			VOLData data;
+			if (cache.find(key, data)) {
+				{
+					// the cache holds the volume as it was resampled
+					std::lock_guard<std::mutex> lock(mutex);
+					if (!cancelled(request_generation))
+						resample_summary = std::to_string(data.resolution.x) + "x" + std::to_string(data.resolution.y) + "x" +
+							std::to_string(data.resolution.z) + " (cached)";
+				}
+				if (publish(request_generation, key, std::move(data)))
+					finish(request_generation, LoadStage::Ready, VOL_filepath);
+				return;
+			}
+
+			data = parseVOLDataFromMappedFile(VOL_filepath.c_str());
+			if (data.name == "Placeholder" || data.values.empty()) {
+				finish(request_generation, LoadStage::Failed, "Could not load: " + VOL_filepath);
+				return;
+			}
+
+			VOLPyramid pyramid;
+			bool cached = readVOLPyramidCache(VOL_filepath, pyramid, true);
+			if (cached)
+				publish(request_generation, key, pyramidLevelAsVOLData(data, pyramid.levels.back()), true);
+
+			ResamplePlan plan = planResample(data, budget);
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (!cancelled(request_generation))
+					resample_summary = plan.describe();
+			}
+			if (plan.needed()) {
+				if (cancelled(request_generation))
+					return;
+				stage = LoadStage::Resampling;
+				progress = 0.0f;
+				std::cout << "Resampling " << VOL_filepath << ": " << plan.describe() << std::endl;
+				bool resampled = resampleVolume(data, plan.resolution, plan.filter, [&](float fraction) {
+					progress = fraction;
+					return !cancelled(request_generation);
+				});
+				if (!resampled) {
+					finish(request_generation, LoadStage::Failed, "Could not resample: " + VOL_filepath);
+					return;
+				}
+			}
+
+			// the statistics pass reads every voxel, which also faults the mapping in here
+			// rather than in the middle of the upload on the render thread
+			if (cancelled(request_generation))
+				return;
+			stage = LoadStage::Statistics;
+			bool completed = computeVOLStatistics(data, [&](float fraction) {
+				progress = fraction;
+				return !cancelled(request_generation);
+			});
+			if (!completed)
+				return;
+			data.macrocells = buildMacrocellGrid(data);
+
+			if (!cached) {
+				if (cancelled(request_generation))
+					return;
+				stage = LoadStage::Pyramid;
+				writeVOLPyramidCache(VOL_filepath, buildVOLPyramid(data));
+			}
+
+			if (cancelled(request_generation))
+				return;
+			stage = LoadStage::Gradients;
+			progress = 0.0f;
+			completed = computeVOLGradients(data, [&](float fraction) {
+				progress = fraction;
+				return !cancelled(request_generation);
+			});
+			if (!completed)
+				return;
+
+			if (cancelled(request_generation))
+				return;
+			stage = LoadStage::Bricking;
+			brick(data);
+
+			cache.insert(key, data);
+			if (publish(request_generation, key, std::move(data)))
+				finish(request_generation, LoadStage::Ready, VOL_filepath);
+		}
+
+		/// <summary>
+		/// Loads a volume into the host cache without handing it over, giving up as soon as a request comes in.
+		/// </summary>
+		void prefetchVolume(const std::string& VOL_filepath, unsigned int request_generation) {
+			VolumeKey key;
+			if (!volumeKey(VOL_filepath, key) || cache.contains(key))
+				return;
+
+			VOLData data = parseVOLDataFromMappedFile(VOL_filepath.c_str());
+			if (data.name == "Placeholder" || data.values.empty() || cancelled(request_generation))
+				return;
+			ResamplePlan plan = planResample(data, budget);
+			if (plan.needed() && !resampleVolume(data, plan.resolution, plan.filter, [&](float) { return !cancelled(request_generation); }))
+				return;
+			bool completed = computeVOLStatistics(data, [&](float) {
+				return !cancelled(request_generation);
+			});
+			if (!completed)
+				return;
+			data.macrocells = buildMacrocellGrid(data);
+
+			VOLPyramid pyramid;
+			if (!readVOLPyramidCache(VOL_filepath, pyramid, true))
+				writeVOLPyramidCache(VOL_filepath, buildVOLPyramid(data));
+			if (!computeVOLGradients(data, [&](float) { return !cancelled(request_generation); }))
+				return;
+			brick(data);
+			cache.insert(key, data);
+		}
+
+		/// <summary>
+		/// Replaces the dense voxels of a sparse volume by its bricks and lays its gradients out like them, leaving a dense volume as it is.
+		/// </summary>
+		void brick(VOLData& data) {
+			data.bricks = brickVolume(data, budget.max_dimension);
+			if (!data.bricks)
+				return;
+			if (!data.gradients.empty())
+				data.gradients = brickVOLGradients(data.gradients, *data.bricks);
+			std::cout << "Bricked " << data.name << ": " << data.bricks->layout.occupied << " of " << data.bricks->layout.pageCount()
+				<< " bricks occupied, " << (data.bricks->layout.poolBytes() >> 20) << " MiB instead of " << (data.values.size() >> 20) << " MiB" << std::endl;
+			data.values.release();
+		}
+
+		/// <summary>
+		/// Makes a volume available to poll(), replacing a preview that has not been picked up yet.
+		/// </summary>
+		/// <param name="preview">Whether the complete volume follows.</param>
+		bool publish(unsigned int request_generation, const VolumeKey& key, VOLData data, bool preview = false) {
+			std::lock_guard<std::mutex> lock(mutex);
+			if (cancelled(request_generation))
+				return false;
+			result = std::move(data);
+			result_key = key;
+			has_result = true;
+			result_preview = preview;
+			return true;
+		}
+};
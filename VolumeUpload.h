@@ -0,0 +1,324 @@
+#pragma once
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "BrickedVolume.h"
+#include "GPUMemory.h"
+#include "VOLGradients.h"
+#include "VOLParser.h"
+#include "VolumeCache.h"
+
+/// <summary>
+/// The texture format each voxel type is uploaded as: the most compact format that holds it exactly,
+/// so the driver copies the voxels without converting them. Integer voxels are sampled normalized.
+/// </summary>
+void volumeTextureFormat(VoxelType voxel_type, GLint& internal_format, GLenum& type) {
+	internal_format = GL_R8;
+	type = GL_UNSIGNED_BYTE;
+	if (voxel_type == VoxelType::UInt16) {
+		internal_format = GL_R16;
+		type = GL_UNSIGNED_SHORT;
+	}
+	else if (voxel_type == VoxelType::Float32) {
+		internal_format = GL_R32F;
+		type = GL_FLOAT;
+	}
+}
+
+/// <summary>
+/// The GPU memory the 3D texture of a volume takes up, see volumeTextureFormat for the formats.
+/// A bricked volume takes up its brick pool and page table, and the gradients take up a texture of the same resolution.
+/// </summary>
+size_t volumeTextureBytes(const VOLData& volume_data) {
+	GLint internal_format;
+	GLenum type;
+	volumeTextureFormat(volume_data.voxel_type, internal_format, type);
+	if (volume_data.bricks) {
+		glm::ivec3 pool_resolution = volume_data.bricks->layout.poolResolution();
+		return (size_t)pool_resolution.x * pool_resolution.y * pool_resolution.z * texelSize(internal_format) +
+			volume_data.bricks->layout.pageCount() * texelSize(GL_RGBA8) + volume_data.gradients.size();
+	}
+	return voxelCount(volume_data) * texelSize(internal_format) + volume_data.gradients.size();
+}
+
+/// <summary>
+/// Creates a linearly filtered, edge clamped 3D texture with storage but no texels yet.
+/// </summary>
+GLuint createFilteredTexture3D(glm::ivec3 resolution, GLint internal_format) {
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_3D, texture);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexStorage3D(GL_TEXTURE_3D, 1, internal_format, resolution.x, resolution.y, resolution.z);
+	glBindTexture(GL_TEXTURE_3D, 0);
+	return texture;
+}
+
+/// <summary>
+/// Creates the texture for a volume with storage but no voxels yet.
+/// </summary>
+GLuint createVolumeTexture(glm::ivec3 resolution, VoxelType voxel_type) {
+	GLint internal_format;
+	GLenum type;
+	volumeTextureFormat(voxel_type, internal_format, type);
+	return createFilteredTexture3D(resolution, internal_format);
+}
+
+/// <summary>
+/// Uploads the page table of a bricked volume, one RGBA8UI texel per brick read with texelFetch.
+/// </summary>
+GLuint storePageTable(const BrickedVolume& bricked) {
+	glm::ivec3 page_count = bricked.layout.page_count;
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_3D, texture);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexStorage3D(GL_TEXTURE_3D, 1, GL_RGBA8UI, page_count.x, page_count.y, page_count.z);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, page_count.x, page_count.y, page_count.z, GL_RGBA_INTEGER, GL_UNSIGNED_BYTE, bricked.page_table.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_3D, 0);
+	return texture;
+}
+
+/// <summary>
+/// Streams a volume into a new 3D texture a few z-slabs per frame through a ring of pixel buffer objects.
+/// Each slab is copied into a buffer and handed to glTexSubImage3D from there, so the driver converts it asynchronously,
+/// and a fence per buffer tells when it can be refilled. Nothing ever waits on the GPU: a buffer that is still in use
+/// ends the frame's share of the upload. The texture is complete once every fence has signalled.
+/// The GL objects belong to the context, call clear() while it is still current.
+/// The texture and buffers are accounted for in the memory budget, if there is one, and the texture stays so once handed over.
+/// A bricked volume streams its brick pool the same way, its page table is small enough to go up at once.
+/// The gradients, if the volume has them, are streamed into a second texture after the voxels.
+/// </summary>
+class VolumeUpload {
+	public:
+		/// <param name="memory_budget">Optional, the budget the texture and buffers are accounted for in.</param>
+		/// <param name="slab_size">The size of each pixel buffer in bytes, a slab is as many slices as fit (at least one).</param>
+		/// <param name="buffer_count">The number of pixel buffers in the ring.</param>
+		explicit VolumeUpload(GPUMemoryBudget* memory_budget = nullptr, size_t slab_size = (size_t)8 << 20, int buffer_count = 3) :
+			memory(memory_budget), slab_bytes(slab_size), buffers(buffer_count, 0), fences(buffer_count, nullptr) {}
+
+		/// <summary>
+		/// Starts uploading a volume into a new texture, cancelling an upload in progress.
+		/// The voxels stay referenced until the upload completes or is cancelled.
+		/// </summary>
+		void begin(const VOLData& volume_data) {
+			cancel();
+			bricks = BrickLayout();
+			resolution = volume_data.resolution;
+			Layer voxels;
+			voxels.values = volume_data.values;
+			if (volume_data.bricks) {
+				bricks = volume_data.bricks->layout;
+				voxels.values = volume_data.bricks->pool;
+				resolution = bricks.poolResolution();
+				page_table = storePageTable(*volume_data.bricks);
+			}
+			volumeTextureFormat(volume_data.voxel_type, voxels.internal_format, voxels.type);
+			addLayer(voxels);
+			if (!volume_data.gradients.empty()) {
+				Layer gradients;
+				gradients.values = volume_data.gradients;
+				gradients.internal_format = GL_RGBA8;
+				gradients.format = GL_RGBA;
+				addLayer(gradients);
+			}
+			next_layer = 0;
+			next_slice = 0;
+			uploaded_slices = 0;
+			if (memory != nullptr && page_table != 0)
+				memory->track(page_table, GPUMemoryCategory::Volume, bricks.pageCount() * texelSize(GL_RGBA8));
+
+			size_t buffer_bytes = 0;
+			for (const Layer& layer : layers)
+				buffer_bytes = std::max(buffer_bytes, layer.slab_slices * layer.slice_bytes);
+			if (buffers[0] == 0)
+				glGenBuffers((GLsizei)buffers.size(), buffers.data());
+			if (buffer_bytes != buffer_size) {
+				buffer_size = buffer_bytes;
+				for (GLuint buffer : buffers) {
+					glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+					glBufferData(GL_PIXEL_UNPACK_BUFFER, buffer_size, NULL, GL_STREAM_DRAW);
+					if (memory != nullptr)
+						memory->track(buffer, GPUMemoryCategory::Staging, buffer_size);
+				}
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			}
+		}
+
+		/// <summary>
+		/// Uploads the next slabs, stopping after frame_bytes or at the first buffer the GPU has not finished with.
+		/// </summary>
+		/// <returns>Whether the texture is complete, in which case finish() hands it over.</returns>
+		bool step(size_t frame_bytes) {
+			if (!active())
+				return false;
+
+			size_t copied = 0;
+			glActiveTexture(GL_TEXTURE0);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			while (next_layer < (int)layers.size() && (copied == 0 || copied + layers[next_layer].slab_slices * layers[next_layer].slice_bytes <= frame_bytes)) {
+				if (!signalled(fences[next_buffer]))
+					break;
+
+				Layer& layer = layers[next_layer];
+				int slices = std::min(layer.slab_slices, resolution.z - next_slice);
+				size_t bytes = slices * layer.slice_bytes;
+				const unsigned char* slab = layer.values.data() + next_slice * layer.slice_bytes;
+				glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffers[next_buffer]);
+				void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+				if (mapped != nullptr) {
+					std::memcpy(mapped, slab, bytes);
+					glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+				}
+				else {
+					glBufferSubData(GL_PIXEL_UNPACK_BUFFER, 0, bytes, slab);
+				}
+				glBindTexture(GL_TEXTURE_3D, layer.texture);
+				glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, next_slice, resolution.x, resolution.y, slices, layer.format, layer.type, (void*)0);
+				fences[next_buffer] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+				next_slice += slices;
+				uploaded_slices += slices;
+				if (next_slice == resolution.z) {
+					++next_layer;
+					next_slice = 0;
+				}
+				next_buffer = (next_buffer + 1) % (int)buffers.size();
+				copied += bytes;
+			}
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			glBindTexture(GL_TEXTURE_3D, 0);
+			// polling does not flush, so submit the fences now rather than at the next buffer swap
+			if (copied > 0)
+				glFlush();
+
+			for (GLsync& fence : fences) {
+				if (!signalled(fence))
+					return false;
+			}
+			return next_layer == (int)layers.size();
+		}
+
+		/// <summary>
+		/// Hands over the completed textures and page table, which the caller then owns. The header is left to the caller.
+		/// </summary>
+		GPUVolume finish() {
+			GPUVolume volume;
+			volume.texture = layers.size() > 0 ? layers[0].texture : 0;
+			volume.gradients = layers.size() > 1 ? layers[1].texture : 0;
+			volume.page_table = page_table;
+			volume.bricks = bricks;
+			layers.clear();
+			page_table = 0;
+			return volume;
+		}
+
+		void cancel() {
+			for (Layer& layer : layers) {
+				if (memory != nullptr)
+					memory->untrack(layer.texture, GPUMemoryCategory::Volume);
+				glDeleteTextures(1, &layer.texture);
+			}
+			if (page_table != 0) {
+				if (memory != nullptr)
+					memory->untrack(page_table, GPUMemoryCategory::Volume);
+				glDeleteTextures(1, &page_table);
+			}
+			layers.clear();
+			page_table = 0;
+			for (GLsync& fence : fences) {
+				if (fence != nullptr)
+					glDeleteSync(fence);
+				fence = nullptr;
+			}
+			next_buffer = 0;
+		}
+
+		/// <summary>
+		/// Cancels the upload and frees the pixel buffers.
+		/// </summary>
+		void clear() {
+			cancel();
+			if (buffers[0] != 0) {
+				for (GLuint buffer : buffers) {
+					if (memory != nullptr)
+						memory->untrack(buffer, GPUMemoryCategory::Staging);
+				}
+				glDeleteBuffers((GLsizei)buffers.size(), buffers.data());
+			}
+			std::fill(buffers.begin(), buffers.end(), 0);
+			buffer_size = 0;
+		}
+
+		bool active() const {
+			return !layers.empty();
+		}
+
+		/// <summary>
+		/// The fraction of the slices handed to the GPU.
+		/// </summary>
+		float progress() const {
+			return active() && resolution.z > 0 ? (float)uploaded_slices / ((size_t)resolution.z * layers.size()) : 0.0f;
+		}
+
+	private:
+		GPUMemoryBudget* memory;
+		size_t slab_bytes;
+		std::vector<GLuint> buffers;
+		std::vector<GLsync> fences;
+		size_t buffer_size = 0;
+		int next_buffer = 0;
+
+		// a texture streamed slice by slice, the voxels and then the gradients
+		struct Layer {
+			VOLValues values;
+			GLuint texture = 0;
+			GLint internal_format = GL_R8;
+			GLenum format = GL_RED, type = GL_UNSIGNED_BYTE;
+			size_t slice_bytes = 0;
+			int slab_slices = 1;
+		};
+
+		std::vector<Layer> layers;
+		glm::ivec3 resolution = glm::ivec3(0);
+		int next_layer = 0, next_slice = 0, uploaded_slices = 0;
+		GLuint page_table = 0;
+		BrickLayout bricks;
+
+		// creates the texture of a layer at the current resolution
+		void addLayer(Layer layer) {
+			layer.slice_bytes = (size_t)resolution.x * resolution.y * texelSize(layer.internal_format);
+			layer.slab_slices = (int)std::max<size_t>(1, slab_bytes / std::max<size_t>(1, layer.slice_bytes));
+			layer.texture = createFilteredTexture3D(resolution, layer.internal_format);
+			if (memory != nullptr)
+				memory->track(layer.texture, GPUMemoryCategory::Volume, layer.slice_bytes * resolution.z);
+			layers.push_back(std::move(layer));
+		}
+
+		// polls a fence without waiting, deleting it once it has signalled
+		static bool signalled(GLsync& fence) {
+			if (fence == nullptr)
+				return true;
+			GLenum status = glClientWaitSync(fence, 0, 0);
+			if (status == GL_TIMEOUT_EXPIRED)
+				return false;
+			glDeleteSync(fence);
+			fence = nullptr;
+			return true;
+		}
+};
@@ -0,0 +1,170 @@
+#pragma once
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Shader.h"
+
+// how the invocations of a work group, and the work groups of a dispatch, are laid over the pixels, see invocationPixel in compute.comp
+enum class PixelOrder {
+	// rows of invocations and rows of work groups
+	Linear = 0,
+	// the invocations of a work group along a Morton curve, so the ones that run together cover a square, the shape has to be a power of two
+	// square or twice as wide as high
+	Morton = 1,
+	// rows of invocations, the work groups in strips a few groups wide, so groups that run together cover a square
+	Swizzled = 2,
+};
+
+/// <summary>
+/// The shape compute.comp is compiled with, its texture fetches are coherent when neighbouring invocations trace neighbouring rays.
+/// </summary>
+struct WorkGroupShape {
+	glm::ivec2 size;
+	PixelOrder order;
+};
+
+const WorkGroupShape DEFAULT_WORK_GROUP_SHAPE = { glm::ivec2(32, 18), PixelOrder::Linear };
+
+// the shapes the tuner times, a Morton order only where the shape allows one
+const WorkGroupShape WORK_GROUP_CANDIDATES[] = {
+	DEFAULT_WORK_GROUP_SHAPE,
+	{ glm::ivec2(8, 8), PixelOrder::Linear },
+	{ glm::ivec2(8, 8), PixelOrder::Swizzled },
+	{ glm::ivec2(16, 8), PixelOrder::Linear },
+	{ glm::ivec2(16, 8), PixelOrder::Morton },
+	{ glm::ivec2(16, 16), PixelOrder::Linear },
+	{ glm::ivec2(16, 16), PixelOrder::Morton },
+	{ glm::ivec2(16, 16), PixelOrder::Swizzled },
+	{ glm::ivec2(32, 8), PixelOrder::Linear },
+	{ glm::ivec2(32, 16), PixelOrder::Morton },
+};
+
+// where the shape chosen for every device is kept between runs, a line per device
+const char* const WORK_GROUP_TUNING_PATH = "workgroup_tuning.txt";
+
+ShaderDefines workGroupShapeDefines(const WorkGroupShape& shape) {
+	return {
+		{ "LOCAL_SIZE_X", std::to_string(shape.size.x) },
+		{ "LOCAL_SIZE_Y", std::to_string(shape.size.y) },
+		{ "PIXEL_ORDER", std::to_string((int)shape.order) },
+	};
+}
+
+std::string workGroupShapeName(const WorkGroupShape& shape) {
+	const char* order_names[] = { "linear", "Morton", "swizzled" };
+	return std::to_string(shape.size.x) + "x" + std::to_string(shape.size.y) + " " + order_names[(int)shape.order];
+}
+
+/// <summary>
+/// The vendor and renderer of the current context, the tuned shapes are kept per device.
+/// </summary>
+std::string graphicsDeviceName() {
+	const GLubyte* vendor = glGetString(GL_VENDOR);
+	const GLubyte* renderer = glGetString(GL_RENDERER);
+	return std::string(vendor != nullptr ? (const char*)vendor : "") + " " + (renderer != nullptr ? (const char*)renderer : "");
+}
+
+/// <summary>
+/// Reads the shape tuned for a device on an earlier run.
+/// </summary>
+/// <returns>False if the device was never tuned.</returns>
+bool loadWorkGroupShape(const std::string& device, WorkGroupShape& shape) {
+	std::ifstream tuning_fstream(WORK_GROUP_TUNING_PATH);
+	std::string line;
+	// every line is "x y order device"
+	while (std::getline(tuning_fstream, line)) {
+		std::istringstream line_stream(line);
+		int x, y, order;
+		std::string line_device;
+		if (!(line_stream >> x >> y >> order) || !std::getline(line_stream >> std::ws, line_device))
+			continue;
+		if (line_device == device && x > 0 && y > 0 && order >= 0 && order <= (int)PixelOrder::Swizzled) {
+			shape = WorkGroupShape{ glm::ivec2(x, y), (PixelOrder)order };
+			return true;
+		}
+	}
+	return false;
+}
+
+/// <summary>
+/// Keeps the shape tuned for a device, replacing what was kept for it before.
+/// </summary>
+void saveWorkGroupShape(const std::string& device, const WorkGroupShape& shape) {
+	std::vector<std::string> lines;
+	{
+		std::ifstream tuning_fstream(WORK_GROUP_TUNING_PATH);
+		std::string line;
+		while (std::getline(tuning_fstream, line)) {
+			std::istringstream line_stream(line);
+			int x, y, order;
+			std::string line_device;
+			if ((line_stream >> x >> y >> order) && std::getline(line_stream >> std::ws, line_device) && line_device != device)
+				lines.push_back(line);
+		}
+	}
+	lines.push_back(std::to_string(shape.size.x) + " " + std::to_string(shape.size.y) + " " + std::to_string((int)shape.order) + " " + device);
+
+	std::ofstream tuning_fstream(WORK_GROUP_TUNING_PATH, std::ios::trunc);
+	if (!tuning_fstream) {
+		std::cerr << "[ERROR] Could not write the work group tuning to " << WORK_GROUP_TUNING_PATH << std::endl;
+		return;
+	}
+	for (const std::string& line : lines)
+		tuning_fstream << line << "\n";
+}
+
+/// <summary>
+/// Times every candidate shape tracing a whole image with the uniforms of the general program, so on the current volume and view,
+/// between GPU timestamps. The variants are compiled into the cache given, whose base definitions are left at the last candidate.
+/// </summary>
+/// <param name="variant_defines">The specialization of the program traced with.</param>
+/// <param name="size">The image size to trace.</param>
+/// <returns>The fastest shape, the default if none compiled.</returns>
+WorkGroupShape tuneWorkGroupShape(ComputeVariants& variants, GLuint general_program, const ShaderDefines& variant_defines, glm::ivec2 size, int repetitions = 3) {
+	GLuint queries[2];
+	glGenQueries(2, queries);
+	WorkGroupShape best = DEFAULT_WORK_GROUP_SHAPE;
+	double best_milliseconds = std::numeric_limits<double>::max();
+	for (const WorkGroupShape& candidate : WORK_GROUP_CANDIDATES) {
+		variants.setBaseDefines(workGroupShapeDefines(candidate));
+		GLuint program = variants.get(variant_defines);
+		if (program == 0)
+			continue;
+		variants.copyUniforms(general_program, program);
+		// progressive tracing would average the repetitions into the accumulated image
+		glUniform1i(glGetUniformLocation(program, "u_progressive"), 0);
+		glUniform2i(glGetUniformLocation(program, "u_render_size"), size.x, size.y);
+		glUniform2i(glGetUniformLocation(program, "u_tile_offset"), 0, 0);
+		GLint local_size[3];
+		glGetProgramiv(program, GL_COMPUTE_WORK_GROUP_SIZE, local_size);
+
+		double fastest = std::numeric_limits<double>::max();
+		// the first dispatch also pays for whatever the driver deferred
+		for (int repetition = 0; repetition <= repetitions; ++repetition) {
+			glQueryCounter(queries[0], GL_TIMESTAMP);
+			glDispatchCompute((size.x + local_size[0] - 1) / local_size[0], (size.y + local_size[1] - 1) / local_size[1], 1);
+			glQueryCounter(queries[1], GL_TIMESTAMP);
+			GLuint64 start = 0, end = 0;
+			glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &start);
+			glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &end);
+			if (repetition > 0)
+				fastest = std::min(fastest, (end - start) * 1e-6);
+		}
+		std::cout << "  " << workGroupShapeName(candidate) << ": " << fastest << " ms" << std::endl;
+		if (fastest < best_milliseconds) {
+			best_milliseconds = fastest;
+			best = candidate;
+		}
+	}
+	glDeleteQueries(2, queries);
+	return best;
+}
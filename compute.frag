@@ -4,7 +4,43 @@ in vec2 texCoord;
 out vec4 fragColor;
 
 uniform sampler2D u_texture;
+// the pixels of u_texture the raytracer filled, from its corner, fewer than the window's while the view is being changed
+uniform ivec2 u_render_size;
 
-void main() { 
-	fragColor = vec4(texture(u_texture, texCoord)); 
+// colour differences well below this are noise rather than an edge to interpolate along
+const float EDGE_THRESHOLD = 0.1;
+
+void main() {
+	if (u_render_size == textureSize(u_texture, 0)) {
+		fragColor = vec4(texture(u_texture, texCoord));
+		return;
+	}
+
+	// a bilinear upscale that leans towards the diagonal of the four texels the colour changes least along,
+	// so a slanted edge is interpolated along rather than across and does not turn into steps
+	vec2 position = texCoord * vec2(u_render_size) - 0.5;
+	ivec2 base = ivec2(floor(position));
+	vec2 f = position - vec2(base);
+	ivec2 last = u_render_size - 1;
+	vec4 texels[4] = vec4[4](
+		texelFetch(u_texture, clamp(base, ivec2(0), last), 0),
+		texelFetch(u_texture, clamp(base + ivec2(1, 0), ivec2(0), last), 0),
+		texelFetch(u_texture, clamp(base + ivec2(0, 1), ivec2(0), last), 0),
+		texelFetch(u_texture, clamp(base + ivec2(1, 1), ivec2(0), last), 0));
+	float weights[4] = float[4]((1.0 - f.x) * (1.0 - f.y), f.x * (1.0 - f.y), (1.0 - f.x) * f.y, f.x * f.y);
+	vec3 diagonal = texels[0].rgb - texels[3].rgb, anti_diagonal = texels[1].rgb - texels[2].rgb;
+	float diagonal_change = dot(diagonal, diagonal), anti_diagonal_change = dot(anti_diagonal, anti_diagonal);
+	float lean = clamp((anti_diagonal_change - diagonal_change) / (diagonal_change + anti_diagonal_change + EDGE_THRESHOLD * EDGE_THRESHOLD), -1.0, 1.0);
+	weights[0] *= 1.0 + lean;
+	weights[3] *= 1.0 + lean;
+	weights[1] *= 1.0 - lean;
+	weights[2] *= 1.0 - lean;
+
+	vec4 color = vec4(0.0);
+	float weight_sum = 1e-5;
+	for (int i = 0; i < 4; ++i) {
+		color += weights[i] * texels[i];
+		weight_sum += weights[i];
+	}
+	fragColor = color / weight_sum;
 }
@@ -0,0 +1,115 @@
+#include <glm/glm.hpp>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "VOLConverter.h"
+
+void printUsage() {
+	std::cout << "Usage: VOLConverter <input> <output> [options]" << std::endl;
+	std::cout << "Formats follow the file extensions: .vol, .nrrd/.nhdr, .mhd/.mha, anything else is raw voxels." << std::endl;
+	std::cout << "Options:" << std::endl;
+	std::cout << "  --dims X Y Z         resolution of a raw input" << std::endl;
+	std::cout << "  --raw-type TYPE      element type of a raw input (int8, uint8, int16, uint16, int32, uint32, float, double)" << std::endl;
+	std::cout << "  --big-endian         a raw input is big endian (default little endian)" << std::endl;
+	std::cout << "  --header-skip BYTES  bytes before the voxels of a raw input" << std::endl;
+	std::cout << "  --spacing X Y Z      voxel spacing of a raw input" << std::endl;
+	std::cout << "  --type u8|u16|f32    voxel type written (default: the closest to the input type)" << std::endl;
+	std::cout << "  --normalize          map the input range onto the whole range of the output type" << std::endl;
+	std::cout << "  --resample X Y Z     resample to this resolution" << std::endl;
+	std::cout << "  --filter NAME        resampling filter, lanczos or trilinear (default lanczos)" << std::endl;
+	std::cout << "  --threads N          number of conversion threads" << std::endl;
+}
+
+int main(int argc, char** argv) {
+	if (argc < 3) {
+		printUsage();
+		return EXIT_FAILURE;
+	}
+
+	std::string input_path = argv[1], output_path = argv[2];
+	VolumeFileLayout source;
+	ConversionOptions options;
+	for (int i = 3; i < argc; ++i) {
+		std::string option = argv[i];
+		auto has_values = [&](int count) {
+			if (i + count < argc)
+				return true;
+			std::cerr << "[ERROR] " << option << " expects " << count << " value(s)." << std::endl;
+			return false;
+		};
+
+		if (option == "--dims" && has_values(3)) {
+			source.resolution = glm::ivec3(std::atoi(argv[i + 1]), std::atoi(argv[i + 2]), std::atoi(argv[i + 3]));
+			i += 3;
+		}
+		else if (option == "--raw-type" && has_values(1)) {
+			if (!parseRawType(argv[++i], source.type)) {
+				std::cerr << "[ERROR] Unknown type " << argv[i] << std::endl;
+				return EXIT_FAILURE;
+			}
+		}
+		else if (option == "--big-endian") {
+			source.big_endian = true;
+		}
+		else if (option == "--header-skip" && has_values(1)) {
+			source.data_offset = (size_t)std::atoll(argv[++i]);
+		}
+		else if (option == "--spacing" && has_values(3)) {
+			source.spacing = glm::vec3(std::atof(argv[i + 1]), std::atof(argv[i + 2]), std::atof(argv[i + 3]));
+			i += 3;
+		}
+		else if (option == "--type" && has_values(1)) {
+			RawType type;
+			if (!parseRawType(argv[++i], type) || (type != RawType::UInt8 && type != RawType::UInt16 && type != RawType::Float32)) {
+				std::cerr << "[ERROR] The output type is one of u8, u16 or f32." << std::endl;
+				return EXIT_FAILURE;
+			}
+			options.has_target_type = true;
+			options.target_type = type == RawType::UInt8 ? VoxelType::UInt8 : (type == RawType::UInt16 ? VoxelType::UInt16 : VoxelType::Float32);
+		}
+		else if (option == "--normalize") {
+			options.normalize = true;
+		}
+		else if (option == "--resample" && has_values(3)) {
+			options.resample_resolution = glm::ivec3(std::atoi(argv[i + 1]), std::atoi(argv[i + 2]), std::atoi(argv[i + 3]));
+			i += 3;
+		}
+		else if (option == "--filter" && has_values(1)) {
+			std::string filter = argv[++i];
+			if (filter == "lanczos")
+				options.resample_filter = ResampleFilter::Lanczos;
+			else if (filter == "trilinear")
+				options.resample_filter = ResampleFilter::Trilinear;
+			else {
+				std::cerr << "[ERROR] The resampling filter is lanczos or trilinear." << std::endl;
+				return EXIT_FAILURE;
+			}
+		}
+		else if (option == "--threads" && has_values(1)) {
+			options.threads = (unsigned int)std::max(1, std::atoi(argv[++i]));
+		}
+		else {
+			std::cerr << "[ERROR] Unknown option " << option << std::endl;
+			printUsage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (!readVolumeLayout(input_path, source))
+		return EXIT_FAILURE;
+
+	std::cout << "Converting " << input_path << " (" << source.resolution.x << "x" << source.resolution.y << "x" << source.resolution.z
+		<< ", " << rawTypeSize(source.type) * 8 << " bit) to " << output_path << std::endl;
+	auto start = std::chrono::steady_clock::now();
+	if (!convertVolume(source, output_path, options)) {
+		std::cerr << "[ERROR] Conversion failed." << std::endl;
+		return EXIT_FAILURE;
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	double megabytes = source.voxelCount() * rawTypeSize(source.type) / (double)(1 << 20);
+	std::cout << "Done in " << seconds << " s (" << megabytes / seconds << " MiB/s read)" << std::endl;
+	return EXIT_SUCCESS;
+}
@@ -14,12 +14,42 @@
 #include <iostream>
 #include <cstdlib>
 #include <limits>
+#include <cmath>
+#include <future>
 
 #include "Shader.h"
 #include "JSONParser.h"
 #include "VOLParser.h"
+#include "VolumeLoader.h"
+#include "VolumeUpload.h"
+#include "GPUMemory.h"
+#include "TimeSeries.h"
+#include "Benchmark.h"
+#include "PreIntegration.h"
+#include "SampleTables.h"
+#include "QualityGovernor.h"
+#include "TileScheduler.h"
+#include "WorkGroupTuning.h"
 
 const bool DEBUG = true;
+const bool BENCHMARK = false;
+
+// recently viewed volumes stay resident up to these budgets, so switching back to them needs no reload
+const size_t HOST_CACHE_BUDGET = (size_t)4 << 30;
+const size_t GPU_CACHE_BUDGET = (size_t)1 << 30;
+// every texture and buffer is accounted for against this, loads that would exceed it evict cached volumes or are refused
+const size_t GPU_MEMORY_BUDGET = (size_t)2 << 30;
+// larger volumes are downsampled when they are loaded, 256M voxels take 1 GiB as R32F
+const size_t VOLUME_VOXEL_BUDGET = (size_t)256 << 20;
+// volumes are streamed to the GPU at most this much per frame, so rendering goes on while they upload
+const size_t UPLOAD_BYTES_PER_FRAME = (size_t)32 << 20;
+
+// a static view is refined progressively by this many jittered samples per pixel, after which nothing is traced until it changes
+const unsigned int PROGRESSIVE_SAMPLES = 64;
+// with nothing to trace or load, the loop blocks on events for at most this long before looking at background work again
+const double IDLE_WAIT_SECONDS = 0.5;
+// frames drawn after an event before blocking again, ImGui takes a few frames to settle hover and focus
+const int UI_SETTLE_FRAMES = 3;
 
 const GLsizei DEFAULT_WIDTH = 800; 
 const GLsizei DEFAULT_HEIGHT = 450; 
@@ -28,10 +58,24 @@ GLFWwindow* main_window;
 ImGuiIO io;
 
 GLsizei window_width, window_height;
-GLuint render_quad, raytracing_result;
+GLuint render_quad, raytracing_result, accumulation_result;
+// the samples per pixel averaged into accumulation_result so far, anything that changes the image starts over
+unsigned int accumulated_samples = 0;
+// whether anything changed the image since it was last traced
+bool image_dirty = true;
+// lowers the quality while the view is being changed, and the size the last image was traced at
+QualityGovernor quality_governor;
+glm::ivec2 traced_size(0);
+// spreads tracing an image over as many frames as its GPU time needs
+TileScheduler tile_scheduler;
 ComputeProgram compute;
+// compute.comp specialized to the render settings, uniforms are set on compute and copied to the variant traced with
+ComputeVariants compute_variants;
 RenderProgram renderer;
 std::vector<GLint> work_group_size(3);
+// the shape compute and its variants are compiled with, work_group_size is read back from it
+WorkGroupShape work_group_shape = DEFAULT_WORK_GROUP_SHAPE;
+GPUMemoryBudget gpu_memory(GPU_MEMORY_BUDGET);
 glm::vec3 camera_spherical(5.0, glm::pi<float>() / 2.0, 0.0); // radius, theta, phi
 
 const glm::mat4 IDENTITY_MATRIX(1.0);
@@ -52,16 +96,17 @@ glm::vec3 sphericalToCartesian(glm::vec3 spherical) {
 	return result;
 }
 
-std::vector<GLint> calculateWorkGroups(std::vector<GLint>& work_group_size) {
+std::vector<GLint> calculateWorkGroups(std::vector<GLint>& work_group_size, glm::ivec2 size) {
 	std::vector<GLint> work_groups(3);
-	work_groups[0] = (window_width + work_group_size[0] - 1) / work_group_size[0];
-	work_groups[1] = (window_height + work_group_size[1] - 1) / work_group_size[1];
+	work_groups[0] = (size.x + work_group_size[0] - 1) / work_group_size[0];
+	work_groups[1] = (size.y + work_group_size[1] - 1) / work_group_size[1];
 	work_groups[2] = 1;
 	return work_groups;
 }
 
 /// <summary>
 /// Sets up a texture for the compute shader to store the result of raytracing into for displaying later.
+/// The image is only ever displayed, so 8 bits per channel are enough.
 /// </summary>
 /// <returns>The associated texture id.</returns>
 GLuint setupRaytracingResultStorage() {
@@ -75,11 +120,49 @@ GLuint setupRaytracingResultStorage() {
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, window_width, window_height, 0, GL_RGBA, GL_FLOAT, NULL);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, window_width, window_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
 	glBindTexture(GL_TEXTURE_2D, 0);
+	gpu_memory.track(texture, GPUMemoryCategory::Output, (size_t)window_width * window_height * texelSize(GL_RGBA8));
 	return texture;
 }
 
+/// <summary>
+/// Sets up a texture for the compute shader to average the samples of progressive rendering in.
+/// A float per channel keeps the running mean exact over many samples.
+/// </summary>
+/// <returns>The associated texture id.</returns>
+GLuint setupAccumulationStorage() {
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	// immutable storage cannot be empty, a minimized window reports a 0x0 framebuffer
+	GLsizei width = std::max(1, window_width), height = std::max(1, window_height);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, width, height);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	gpu_memory.track(texture, GPUMemoryCategory::Output, (size_t)width * height * texelSize(GL_RGBA32F));
+	return texture;
+}
+
+/// <summary>
+/// Marks the image for tracing again and discards the samples accumulated so far, called whenever anything that changes the image does.
+/// </summary>
+/// <param name="interaction">Whether the change comes from the user dragging or editing, which the governor trades quality for speed during.</param>
+void invalidateImage(bool interaction = false) {
+	image_dirty = true;
+	accumulated_samples = 0;
+	tile_scheduler.restart();
+	if (interaction)
+		quality_governor.input(glfwGetTime());
+}
+
+/// <summary>
+/// Whether the next frame has to trace, otherwise the last result is presented as it is.
+/// </summary>
+bool imageOutOfDate(bool progressive) {
+	return image_dirty || (progressive && accumulated_samples < PROGRESSIVE_SAMPLES);
+}
+
 /// <summary>
 /// Callback to dynamically update window viewport to match window size.
 /// </summary>
@@ -89,10 +172,14 @@ GLuint setupRaytracingResultStorage() {
 void framebuffer_size_callback(GLFWwindow* window, GLsizei width, GLsizei height) {
 	window_width = width, window_height = height;
 
-	compute.workgroups = calculateWorkGroups(work_group_size);
+	compute.workgroups = calculateWorkGroups(work_group_size, glm::ivec2(window_width, window_height));
 	if (glIsTexture(raytracing_result))
-		glDeleteTextures(1, &raytracing_result);
+		gpu_memory.deleteTexture(raytracing_result, GPUMemoryCategory::Output);
 	raytracing_result = setupRaytracingResultStorage();
+	if (glIsTexture(accumulation_result))
+		gpu_memory.deleteTexture(accumulation_result, GPUMemoryCategory::Output);
+	accumulation_result = setupAccumulationStorage();
+	invalidateImage();
 
 	glViewport(0, 0, width, height);
 }
@@ -132,6 +219,7 @@ void mouse_cursor_callback(GLFWwindow* window, double xpos, double ypos) {
 		camera_spherical.y += glm::pi<float>() * (last_mpos.y - ypos) / (window_height); // theta is vertical
 		camera_spherical.y = glm::clamp<float>(camera_spherical.y, 1e-5, glm::pi<float>() - 1e-5);
 		last_mpos.x = xpos, last_mpos.y = ypos;
+		invalidateImage(true);
 	}
 }
 
@@ -148,6 +236,7 @@ void mouse_scroll_callback(GLFWwindow* window, double xdelta, double ydelta) {
 	else {
 		camera_spherical.x *= 0.95;
 	}
+	invalidateImage(true);
 }
 
 /// <summary>
@@ -304,18 +393,22 @@ GLuint storeVolumeData(VOLData& volume_data) {
 	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
+	GLint internal_format;
+	GLenum type;
+	volumeTextureFormat(volume_data.voxel_type, internal_format, type);
+
 	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 	glTexImage3D(
 		GL_TEXTURE_3D,
 		0,
-		GL_R16F,
+		internal_format,
 		volume_data.resolution.x,
 		volume_data.resolution.y,
 		volume_data.resolution.z,
 		0,
 		GL_RED,
-		GL_UNSIGNED_BYTE,
-		&(volume_data.values[0])
+		type,
+		volume_data.values.data()
 	);
 	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 
@@ -328,16 +421,144 @@ GLuint storeVolumeData(VOLData& volume_data) {
 		std::cout << "Texture Generated has dimensions: " << _x << " " << _y << " " << _z << std::endl;
 	}
 
+	glBindTexture(GL_TEXTURE_3D, 0);
+	gpu_memory.track(texture, GPUMemoryCategory::Volume, volumeTextureBytes(volume_data));
+	return texture;
+}
+
+/// <summary>
+/// Compares uploading a synthetic volume with storeVolumeData against streaming it with VolumeUpload.
+/// Besides the total time it reports the longest the render thread is held up in one frame,
+/// which is the whole upload for storeVolumeData.
+/// </summary>
+void benchmarkVolumeUpload(glm::ivec3 resolution, VoxelType voxel_type, int repetitions = 3) {
+	VOLData volume_data;
+	volume_data.name = "Synthetic";
+	volume_data.resolution = resolution;
+	volume_data.saved_border = 0;
+	volume_data.true_size = glm::vec3(1.0f);
+	volume_data.voxel_type = voxel_type;
+	std::vector<unsigned char> values(voxelCount(volume_data) * voxelSize(voxel_type));
+	for (size_t i = 0; i < values.size(); ++i)
+		values[i] = (unsigned char)(i * 2654435761u >> 24);
+	volume_data.values = std::move(values);
+	double megabytes = volume_data.values.size() / (double)(1 << 20);
+
+	std::cout << "----- Upload Benchmark: " << resolution.x << "x" << resolution.y << "x" << resolution.z << " "
+		<< voxelTypeName(voxel_type) << " (" << megabytes << " MiB) -----" << std::endl;
+	for (int repetition = 0; repetition < repetitions; ++repetition) {
+		auto start = std::chrono::steady_clock::now();
+		GLuint texture = storeVolumeData(volume_data);
+		glFinish();
+		double synchronous = elapsedMilliseconds(start);
+		gpu_memory.deleteTexture(texture, GPUMemoryCategory::Volume);
+
+		VolumeUpload upload;
+		int frames = 0;
+		start = std::chrono::steady_clock::now();
+		upload.begin(volume_data);
+		// allocating the texture holds up a frame too
+		double longest_frame = elapsedMilliseconds(start);
+		while (true) {
+			auto frame_start = std::chrono::steady_clock::now();
+			bool complete = upload.step(UPLOAD_BYTES_PER_FRAME);
+			longest_frame = std::max(longest_frame, elapsedMilliseconds(frame_start));
+			++frames;
+			if (complete)
+				break;
+		}
+		double streamed = elapsedMilliseconds(start);
+		texture = upload.finish().texture;
+		glDeleteTextures(1, &texture);
+		upload.clear();
+
+		std::cout << "  glTexImage3D: " << synchronous << " ms (" << megabytes / synchronous * 1000.0 << " MiB/s), "
+			<< "PBO slabs: " << streamed << " ms over " << frames << " frames, longest frame " << longest_frame << " ms" << std::endl;
+	}
+}
+
+/// <summary>
+/// A rotating pool of 3D textures the timesteps of a series are uploaded into. Each timestep goes into the texture
+/// after the one being rendered, so the upload never has to wait for the GPU to finish with the texture in use.
+/// </summary>
+struct VolumeTexturePool {
+	std::vector<GLuint> textures;
+	int next = 0;
+	glm::ivec3 resolution = glm::ivec3(0);
+	VoxelType voxel_type = VoxelType::UInt8;
+};
+
+void clearTexturePool(VolumeTexturePool& pool) {
+	for (GLuint& texture : pool.textures)
+		gpu_memory.deleteTexture(texture, GPUMemoryCategory::Volume);
+	pool.textures.clear();
+	pool.next = 0;
+}
+
+/// <summary>
+/// Uploads a timestep into the next texture of the pool, (re)creating the pool when the volume changes shape.
+/// </summary>
+/// <param name="pool_size">The number of textures in the pool, three keeps one rendering, one uploading and one spare.</param>
+/// <returns>The texture holding the timestep, owned by the pool.</returns>
+GLuint uploadToTexturePool(VolumeTexturePool& pool, const VOLData& volume_data, int pool_size = 3) {
+	GLint internal_format;
+	GLenum type;
+	volumeTextureFormat(volume_data.voxel_type, internal_format, type);
+
+	if (pool.textures.empty() || pool.resolution != volume_data.resolution || pool.voxel_type != volume_data.voxel_type) {
+		clearTexturePool(pool);
+		pool.resolution = volume_data.resolution;
+		pool.voxel_type = volume_data.voxel_type;
+		for (int i = 0; i < pool_size; ++i) {
+			pool.textures.push_back(createVolumeTexture(pool.resolution, pool.voxel_type));
+			gpu_memory.track(pool.textures.back(), GPUMemoryCategory::Volume, volumeTextureBytes(volume_data));
+		}
+	}
+
+	GLuint texture = pool.textures[pool.next];
+	pool.next = (pool.next + 1) % (int)pool.textures.size();
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_3D, texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, pool.resolution.x, pool.resolution.y, pool.resolution.z, GL_RED, type, volume_data.values.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 	glBindTexture(GL_TEXTURE_3D, 0);
 	return texture;
 }
 
 int volume_id = 3;
 
-void prepareVolumeData(VOLData& volume_data, glm::mat4& volume_inverse_matrix, GLuint& texture, GLuint compute_program) {
-	if (DEBUG)
-		printVOLData(volume_data);
+/// <summary>
+/// The (offset, scale) that maps a sampled voxel to its transfer function coordinate as (sample - offset) * scale.
+/// Integer textures sample normalized values, float textures sample the raw values.
+/// </summary>
+glm::vec2 volumeValueTransform(const VOLData& volume_data) {
+	glm::vec2 domain = transferFunctionDomain(volume_data);
+	if (volume_data.voxel_type == VoxelType::Float32 && !volume_data.statistics.computed) {
+		// previews arrive before their statistics
+		glm::vec2 range = floatValueRange((const float*)volume_data.values.data(), voxelCount(volume_data));
+		domain = transferFunctionDomain(volume_data.voxel_type, range.x, range.y);
+	}
+
+	float normalization = 1.0f;
+	if (volume_data.voxel_type == VoxelType::UInt8)
+		normalization = 255.0f;
+	else if (volume_data.voxel_type == VoxelType::UInt16)
+		normalization = 65535.0f;
+	return glm::vec2(domain.x / normalization, normalization / (domain.y - domain.x));
+}
 
+/// <summary>
+/// The number of entries in the transfer function table, wider voxel types get a finer table.
+/// </summary>
+int transferFunctionTableSize(VoxelType voxel_type) {
+	return voxel_type == VoxelType::UInt8 ? 256 : 4096;
+}
+
+/// <summary>
+/// Sets up the volume matrix and value transform of a volume whose texture is about to be rendered.
+/// </summary>
+void placeVolume(const VOLData& volume_data, glm::mat4& volume_inverse_matrix, GLuint compute_program) {
 	glUseProgram(compute_program);
 
 	// will scale box to shape of true size, but remain in -0.5 to 0.5 range
@@ -356,9 +577,106 @@ void prepareVolumeData(VOLData& volume_data, glm::mat4& volume_inverse_matrix, G
 
 	volume_inverse_matrix = glm::inverse(volume_inverse_matrix);
 
-	if (glIsTexture(texture))
-		glDeleteTextures(1, &texture);
-	texture = storeVolumeData(volume_data);
+	glm::vec2 value_transform = volumeValueTransform(volume_data);
+	glUniform2fv(glGetUniformLocation(compute_program, "u_value_transform"), 1, glm::value_ptr(value_transform));
+	// the step size follows the voxel spacing
+	glUniform3fv(glGetUniformLocation(compute_program, "u_volume_resolution"), 1, glm::value_ptr(glm::vec3(volume_data.resolution)));
+}
+
+/// <summary>
+/// Tells the compute shader whether the volume texture is a brick pool and how to find the bricks in it.
+/// </summary>
+void placeBricks(const BrickLayout& bricks, GLuint compute_program) {
+	glUseProgram(compute_program);
+	glUniform1i(glGetUniformLocation(compute_program, "u_bricked"), bricks.bricked);
+	if (!bricks.bricked)
+		return;
+
+	float normalization = 1.0f;
+	if (bricks.voxel_type == VoxelType::UInt8)
+		normalization = 255.0f;
+	else if (bricks.voxel_type == VoxelType::UInt16)
+		normalization = 65535.0f;
+	glUniform1i(glGetUniformLocation(compute_program, "u_brick_size"), BRICK_SIZE);
+	glUniform1i(glGetUniformLocation(compute_program, "u_brick_ghost"), BRICK_GHOST);
+	glUniform3iv(glGetUniformLocation(compute_program, "u_page_count"), 1, glm::value_ptr(bricks.page_count));
+	glUniform3fv(glGetUniformLocation(compute_program, "u_pool_size"), 1, glm::value_ptr(glm::vec3(bricks.poolResolution())));
+	glUniform1f(glGetUniformLocation(compute_program, "u_background"), bricks.background / normalization);
+}
+
+/// <summary>
+/// How densely the raytracer samples, trading image error for frame time.
+/// </summary>
+struct SamplingQuality {
+	const char* name;
+	// the base rate of the march along the ray
+	float samples_per_voxel;
+	// the longest stride, in base steps, the march takes through transparent values, 1 keeps the base rate
+	float transparent_stride;
+	// whether strong gradients halve the step, so boundaries are sampled finely
+	bool refine_boundaries;
+};
+
+// from fastest to finest, the last one samples uniformly and is what the others are measured against
+const SamplingQuality SAMPLING_QUALITIES[] = {
+	{ "Fastest", 0.5f, 2.0f, false },
+	{ "Fast", 1.0f, 2.0f, false },
+	{ "Balanced", 1.0f, 2.0f, true },
+	{ "Fine", 2.0f, 1.0f, true },
+	{ "Reference", 4.0f, 1.0f, false },
+};
+const int SAMPLING_QUALITY_COUNT = sizeof(SAMPLING_QUALITIES) / sizeof(SAMPLING_QUALITIES[0]);
+const int DEFAULT_SAMPLING_QUALITY = 2;
+
+/// <summary>
+/// Sets the step policy of the compute shader.
+/// </summary>
+void placeSampling(const SamplingQuality& quality, GLuint compute_program) {
+	glUseProgram(compute_program);
+	glUniform1f(glGetUniformLocation(compute_program, "u_samples_per_voxel"), quality.samples_per_voxel);
+	glUniform1f(glGetUniformLocation(compute_program, "u_transparent_stride"), quality.transparent_stride);
+	glUniform1i(glGetUniformLocation(compute_program, "u_refine_boundaries"), quality.refine_boundaries);
+}
+
+/// <summary>
+/// Places the volume and uploads it into a new texture. The caller swaps it in for the previous texture,
+/// so the old volume stays valid until the new one is complete.
+/// </summary>
+/// <returns>The new texture id.</returns>
+GLuint prepareVolumeData(VOLData& volume_data, glm::mat4& volume_inverse_matrix, GLuint compute_program) {
+	if (DEBUG)
+		printVOLData(volume_data);
+
+	placeVolume(volume_data, volume_inverse_matrix, compute_program);
+	GLuint texture = storeVolumeData(volume_data);
+
+	// the texture now holds the voxels, so drop this copy (the host cache keeps its own)
+	volume_data.values.release();
+	return texture;
+}
+
+/// <summary>
+/// Uploads a volume thumbnail for display in ImGui.
+/// </summary>
+/// <param name="thumbnail">The RGBA image of the thumbnail.</param>
+/// <returns>The associated texture id, 0 if the thumbnail is empty.</returns>
+GLuint storeThumbnail(const VOLThumbnail& thumbnail) {
+	if (thumbnail.rgba.empty())
+		return 0;
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, thumbnail.width, thumbnail.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, thumbnail.rgba.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	gpu_memory.track(texture, GPUMemoryCategory::Thumbnail, (size_t)thumbnail.width * thumbnail.height * texelSize(GL_RGBA8));
+	return texture;
 }
 
 void generateVolumeMatrix(glm::mat4& volume_inv_matrix, glm::vec3& rotation, glm::vec3& scaling) {
@@ -378,8 +696,10 @@ void generateVolumeMatrix(glm::mat4& volume_inv_matrix, glm::vec3& rotation, glm
 /// </summary>
 /// <param name="color_map">The map which will have its entries interpolated.</param>
 /// <param name="colors">A reference to the array of colors that will store the interpolated colors.</param>
-void interpolate_color(std::map<int, glm::vec3>& color_map, std::vector<glm::vec4>& colors) {
-	colors.resize(256);
+/// <param name="table_size">The number of colors, the 0 - 255 keys are spread evenly across them.</param>
+void interpolate_color(std::map<int, glm::vec3>& color_map, std::vector<glm::vec4>& colors, int table_size = 256) {
+	colors.resize(table_size);
+	float key_scale = (table_size - 1) / 255.0f;
 
 	if (!color_map.count(0)) {
 		color_map[0] = glm::vec3(0.0);
@@ -394,8 +714,9 @@ void interpolate_color(std::map<int, glm::vec3>& color_map, std::vector<glm::vec
 	for (auto &[tend, cend] : color_map) {
 		// Skip any entries in the map that are out of bounds.
 		if (tend < 0 || tend > 255) continue;
+		int pend = (int)std::lround(tend * key_scale);
 
-		tdiff = tend - tstart;
+		tdiff = pend - tstart;
 		cdiff = cend - cstart;
 		
 		// interpolate all values between tstart and tend, exclusively
@@ -406,11 +727,11 @@ void interpolate_color(std::map<int, glm::vec3>& color_map, std::vector<glm::vec
 			colors[tstart + i].b = (cstart + cdiff * interp).b;
 		}
 
-		colors[tend].r = cend.r;
-		colors[tend].g = cend.g;
-		colors[tend].b = cend.b;
+		colors[pend].r = cend.r;
+		colors[pend].g = cend.g;
+		colors[pend].b = cend.b;
 
-		tstart = tend;
+		tstart = pend;
 		cstart = cend;
 	}
 }
@@ -421,8 +742,10 @@ void interpolate_color(std::map<int, glm::vec3>& color_map, std::vector<glm::vec
 /// </summary>
 /// <param name="opacity_map">The map which will have its entries interpolated.</param>
 /// <param name="opacities">A reference to the array of opacities that will store the interpolated opacities.</param>
-void interpolate_opacity(std::map<int, float>& opacity_map, std::vector<glm::vec4>& opacities) {
-	opacities.resize(256);
+/// <param name="table_size">The number of opacities, the 0 - 255 keys are spread evenly across them.</param>
+void interpolate_opacity(std::map<int, float>& opacity_map, std::vector<glm::vec4>& opacities, int table_size = 256) {
+	opacities.resize(table_size);
+	float key_scale = (table_size - 1) / 255.0f;
 
 	if (!opacity_map.count(0)) {
 		opacity_map[0] = 0.0;
@@ -437,8 +760,9 @@ void interpolate_opacity(std::map<int, float>& opacity_map, std::vector<glm::vec
 	for (auto& [tend, oend] : opacity_map) {
 		// Skip any entries in the map that are out of bounds.
 		if (tend < 0 || tend > 255) continue;
+		int pend = (int)std::lround(tend * key_scale);
 
-		tdiff = tend - tstart;
+		tdiff = pend - tstart;
 		odiff = oend - ostart;
 
 		// interpolate all values between tstart and tend, exclusively
@@ -447,20 +771,24 @@ void interpolate_opacity(std::map<int, float>& opacity_map, std::vector<glm::vec
 			opacities[tstart + i].a = (ostart + odiff * interp);
 		}
 
-		opacities[tend].a = oend;
+		opacities[pend].a = oend;
 
-		tstart = tend;
+		tstart = pend;
 		ostart = oend;
 	}
 }
 
-void storeTransferFunction(std::map<int, glm::vec3>& tfunc_color, std::map<int, float>& tfunc_opacity, GLuint& texture, GLuint compute_program) {
+/// <summary>
+/// Interpolates the transfer function control points into a table and uploads it.
+/// </summary>
+/// <returns>The table, for working out what it hides.</returns>
+std::vector<glm::vec4> storeTransferFunction(std::map<int, glm::vec3>& tfunc_color, std::map<int, float>& tfunc_opacity, GLuint& texture, GLuint compute_program, int table_size = 256) {
 	glUseProgram(compute_program);
 
 	if (DEBUG)
 		std::cout << "Setting the Transfer Function Storage with the compute shader." << std::endl;
 	if (glIsTexture(texture))
-		glDeleteTextures(1, &texture);
+		gpu_memory.deleteTexture(texture, GPUMemoryCategory::TransferFunction);
 
 	glGenTextures(1, &texture);
 	glActiveTexture(GL_TEXTURE0);
@@ -469,17 +797,10 @@ void storeTransferFunction(std::map<int, glm::vec3>& tfunc_color, std::map<int,
 	glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-	std::vector<glm::vec4> full_tfunc(256);
+	std::vector<glm::vec4> full_tfunc(table_size);
 
-	for (auto [key, value] : tfunc_color) {
-		full_tfunc[key] = glm::vec4(value, 0.0);
-	}
-	for (auto [key, value] : tfunc_opacity) {
-		full_tfunc[key].a = value;
-	}
-
-	interpolate_color(tfunc_color, full_tfunc);
-	interpolate_opacity(tfunc_opacity, full_tfunc);
+	interpolate_color(tfunc_color, full_tfunc, table_size);
+	interpolate_opacity(tfunc_opacity, full_tfunc, table_size);
 
 	glTexImage1D(
 		GL_TEXTURE_1D,
@@ -493,8 +814,340 @@ void storeTransferFunction(std::map<int, glm::vec3>& tfunc_color, std::map<int,
 	);
 
 	glBindTexture(GL_TEXTURE_1D, 0);
+	gpu_memory.track(texture, GPUMemoryCategory::TransferFunction, full_tfunc.size() * texelSize(GL_RGBA16F));
+	return full_tfunc;
+}
+
+/// <summary>
+/// Brings the pre-integrated transfer function up to date with the transfer function table and uploads it when it changed,
+/// into a PREINTEGRATION_SIZE square RGBA16F texture. Called whenever the transfer function changes.
+/// </summary>
+void storePreIntegratedTransferFunction(const std::vector<glm::vec4>& tfunc_table, PreIntegrationTable& preintegration, GLuint& texture) {
+	if (!preintegration.update(tfunc_table) && texture != 0)
+		return;
+
+	glActiveTexture(GL_TEXTURE0);
+	if (texture == 0) {
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, PREINTEGRATION_SIZE, PREINTEGRATION_SIZE);
+		gpu_memory.track(texture, GPUMemoryCategory::TransferFunction, (size_t)PREINTEGRATION_SIZE * PREINTEGRATION_SIZE * texelSize(GL_RGBA16F));
+	}
+	glBindTexture(GL_TEXTURE_2D, texture);
+	// the back value runs fastest, so it is the x coordinate of the texture and the front value the y
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, PREINTEGRATION_SIZE, PREINTEGRATION_SIZE, GL_RGBA, GL_FLOAT, preintegration.data().data());
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+/// <summary>
+/// Builds the sample sequence and its per-pixel rotations and uploads them, a SAMPLE_SEQUENCE_LENGTH wide RGBA32F 1D texture
+/// and a SAMPLE_SCRAMBLE_SIZE square RGBA16F texture, read with texelFetch and accounted with the other shader lookup tables. They never change, so they are left bound to units 7 and 8.
+/// </summary>
+void storeSampleTables(GLuint& sequence_texture, GLuint& scramble_texture) {
+	std::vector<glm::vec4> sequence = buildSampleSequence();
+	std::vector<glm::vec4> scramble = buildSampleScramble();
+
+	glGenTextures(1, &sequence_texture);
+	glActiveTexture(GL_TEXTURE7);
+	glBindTexture(GL_TEXTURE_1D, sequence_texture);
+	glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexStorage1D(GL_TEXTURE_1D, 1, GL_RGBA32F, SAMPLE_SEQUENCE_LENGTH);
+	glTexSubImage1D(GL_TEXTURE_1D, 0, 0, SAMPLE_SEQUENCE_LENGTH, GL_RGBA, GL_FLOAT, sequence.data());
+	gpu_memory.track(sequence_texture, GPUMemoryCategory::TransferFunction, (size_t)SAMPLE_SEQUENCE_LENGTH * texelSize(GL_RGBA32F));
+
+	glGenTextures(1, &scramble_texture);
+	glActiveTexture(GL_TEXTURE8);
+	glBindTexture(GL_TEXTURE_2D, scramble_texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, SAMPLE_SCRAMBLE_SIZE, SAMPLE_SCRAMBLE_SIZE);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, SAMPLE_SCRAMBLE_SIZE, SAMPLE_SCRAMBLE_SIZE, GL_RGBA, GL_FLOAT, scramble.data());
+	gpu_memory.track(scramble_texture, GPUMemoryCategory::TransferFunction, (size_t)SAMPLE_SCRAMBLE_SIZE * SAMPLE_SCRAMBLE_SIZE * texelSize(GL_RGBA16F));
+	glActiveTexture(GL_TEXTURE0);
+}
+
+/// <summary>
+/// Brings the macrocell distance map of the volume up to date with the transfer function and uploads what changed,
+/// one R8UI texel per cell, or turns empty space leaping off for volumes without a macrocell grid.
+/// Called whenever the volume or the transfer function changes.
+/// </summary>
+void storeMacrocellDistances(const VOLData& volume_data, const std::vector<glm::vec4>& tfunc_table, MacrocellDistanceMap& distance_map,
+	GLuint& texture, GLuint compute_program) {
+	glUseProgram(compute_program);
+	glUniform1i(glGetUniformLocation(compute_program, "u_skipping"), volume_data.macrocells != nullptr);
+	if (!volume_data.macrocells)
+		return;
+
+	const MacrocellGrid& grid = *volume_data.macrocells;
+	glm::ivec3 texture_cells = distance_map.cellCount();
+	glm::ivec3 changed_begin, changed_end;
+	std::vector<unsigned char> visibility = macrocellVisibility(grid, tfunc_table, transferFunctionDomain(volume_data));
+	if (!distance_map.update(visibility, grid.cell_count, changed_begin, changed_end) && texture != 0)
+		return;
+
+	glActiveTexture(GL_TEXTURE0);
+	if (texture == 0 || texture_cells != grid.cell_count) {
+		// the distances depend on the transfer function, so they are accounted for with it
+		gpu_memory.deleteTexture(texture, GPUMemoryCategory::TransferFunction);
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_3D, texture);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexStorage3D(GL_TEXTURE_3D, 1, GL_R8UI, grid.cell_count.x, grid.cell_count.y, grid.cell_count.z);
+		gpu_memory.track(texture, GPUMemoryCategory::TransferFunction, grid.cellCount());
+		changed_begin = glm::ivec3(0);
+		changed_end = grid.cell_count;
+	}
+	glBindTexture(GL_TEXTURE_3D, texture);
+	glm::ivec3 changed_size = changed_end - changed_begin;
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexSubImage3D(GL_TEXTURE_3D, 0, changed_begin.x, changed_begin.y, changed_begin.z, changed_size.x, changed_size.y, changed_size.z,
+		GL_RED_INTEGER, GL_UNSIGNED_BYTE, distance_map.distances(changed_begin, changed_end).data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_3D, 0);
+
+	glUniform1i(glGetUniformLocation(compute_program, "u_macrocell_size"), MACROCELL_SIZE);
+	glUniform3iv(glGetUniformLocation(compute_program, "u_macrocell_count"), 1, glm::value_ptr(grid.cell_count));
 }
 
+/// <summary>
+/// The definitions that specialize compute.comp to the render settings, see the #ifndef block at its top.
+/// </summary>
+ShaderDefines computeVariantDefines(int samples_per_side, bool shading, bool preintegrated, bool bricked) {
+	return {
+		{ "SAMPLES_PER_SIDE", std::to_string(samples_per_side) },
+		{ "SHADING", shading ? "true" : "false" },
+		{ "PREINTEGRATED", preintegrated ? "true" : "false" },
+		{ "BRICKED", bricked ? "true" : "false" },
+	};
+}
+
+/// <summary>
+/// Compiles the general compute program with a work group shape, carrying the uniforms over from the program it replaces,
+/// and has the variants follow the shape.
+/// </summary>
+/// <returns>False if the shape does not compile, compute is left as it was.</returns>
+bool compileComputeProgram(const WorkGroupShape& shape) {
+	ComputeProgram shaped;
+	if (!shaped.generateProgramFromText(defineShaderVariant(compute_variants.source(), workGroupShapeDefines(shape)))) {
+		if (shaped.program != 0)
+			glDeleteProgram(shaped.program);
+		return false;
+	}
+	if (compute.program != 0) {
+		compute_variants.copyUniforms(compute.program, shaped.program);
+		glDeleteProgram(compute.program);
+	}
+	compute.program = shaped.program;
+	compute_variants.setBaseDefines(workGroupShapeDefines(shape));
+	work_group_shape = shape;
+
+	glGetProgramiv(compute.program, GL_COMPUTE_WORK_GROUP_SIZE, work_group_size.data());
+	compute.workgroups = calculateWorkGroups(work_group_size, glm::ivec2(window_width, window_height));
+	invalidateImage();
+	return true;
+}
+
+/// <summary>
+/// The textures the raytracing benchmarks render a volume with.
+/// </summary>
+struct BenchmarkScene {
+	GLuint volume_texture = 0, tfunc_texture = 0, macrocell_texture = 0, preintegrated_texture = 0;
+	MacrocellDistanceMap distance_map;
+	PreIntegrationTable preintegration;
+};
+
+/// <summary>
+/// Uploads a volume and sets up the compute shader to render it from the default camera, with a white transfer function.
+/// </summary>
+/// <param name="tfunc_opacity">The opacity keys of the transfer function.</param>
+/// <returns>False if the volume could not be loaded.</returns>
+bool setupBenchmarkScene(VOLData& volume_data, BenchmarkScene& scene, std::map<int, float> tfunc_opacity) {
+	if (volume_data.name == "Placeholder" || volume_data.values.empty())
+		return false;
+	computeVOLStatistics(volume_data);
+	volume_data.macrocells = buildMacrocellGrid(volume_data);
+
+	std::map<int, glm::vec3> tfunc_color = { { 0, glm::vec3(1.0f) }, { 255, glm::vec3(1.0f) } };
+	scene.volume_texture = storeVolumeData(volume_data);
+	std::vector<glm::vec4> tfunc_table = storeTransferFunction(tfunc_color, tfunc_opacity, scene.tfunc_texture, compute.program,
+		transferFunctionTableSize(volume_data.voxel_type));
+	storeMacrocellDistances(volume_data, tfunc_table, scene.distance_map, scene.macrocell_texture, compute.program);
+	storePreIntegratedTransferFunction(tfunc_table, scene.preintegration, scene.preintegrated_texture);
+
+	glm::mat4 volume_inv_matrix;
+	placeVolume(volume_data, volume_inv_matrix, compute.program);
+	placeBricks(BrickLayout(), compute.program);
+	placeSampling(SAMPLING_QUALITIES[DEFAULT_SAMPLING_QUALITY], compute.program);
+	glm::vec3 cam_eye = sphericalToCartesian(camera_spherical);
+	glm::vec3 w = glm::normalize(cam_eye), u = glm::normalize(glm::cross(glm::vec3(0, 1, 0), w)), v = glm::normalize(glm::cross(w, u));
+	glUniform3fv(glGetUniformLocation(compute.program, "u_cam_eye"), 1, glm::value_ptr(cam_eye));
+	glUniform3fv(glGetUniformLocation(compute.program, "u_cam_w"), 1, glm::value_ptr(w));
+	glUniform3fv(glGetUniformLocation(compute.program, "u_cam_u"), 1, glm::value_ptr(u));
+	glUniform3fv(glGetUniformLocation(compute.program, "u_cam_v"), 1, glm::value_ptr(v));
+	for (const char* slice : { "u_xslice", "u_yslice", "u_zslice" })
+		glUniform2fv(glGetUniformLocation(compute.program, slice), 1, glm::value_ptr(glm::vec2(0.0f, 1.0f)));
+	glUniformMatrix4fv(glGetUniformLocation(compute.program, "u_volume_inv_matrix"), 1, GL_FALSE, glm::value_ptr(volume_inv_matrix));
+	glUniform1i(glGetUniformLocation(compute.program, "u_shading"), 0);
+	glUniform1i(glGetUniformLocation(compute.program, "u_preintegrated"), 0);
+	glUniform1i(glGetUniformLocation(compute.program, "u_progressive"), 0);
+	glUniform1i(glGetUniformLocation(compute.program, "u_samples_per_side"), FULL_SAMPLES_PER_SIDE);
+	glUniform2i(glGetUniformLocation(compute.program, "u_render_size"), window_width, window_height);
+
+	glBindImageTexture(0, raytracing_result, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_3D, scene.volume_texture);
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_1D, scene.tfunc_texture);
+	glActiveTexture(GL_TEXTURE5);
+	glBindTexture(GL_TEXTURE_3D, scene.macrocell_texture);
+	glActiveTexture(GL_TEXTURE6);
+	glBindTexture(GL_TEXTURE_2D, scene.preintegrated_texture);
+	return true;
+}
+
+void clearBenchmarkScene(BenchmarkScene& scene) {
+	gpu_memory.deleteTexture(scene.volume_texture, GPUMemoryCategory::Volume);
+	gpu_memory.deleteTexture(scene.tfunc_texture, GPUMemoryCategory::TransferFunction);
+	gpu_memory.deleteTexture(scene.macrocell_texture, GPUMemoryCategory::TransferFunction);
+	gpu_memory.deleteTexture(scene.preintegrated_texture, GPUMemoryCategory::TransferFunction);
+}
+
+/// <summary>
+/// Raytraces the benchmark scene a number of times.
+/// </summary>
+/// <returns>The fastest frame in milliseconds.</returns>
+double timeRaytracing(int repetitions) {
+	double best = std::numeric_limits<double>::max();
+	// the first frame also compiles and uploads whatever the driver deferred
+	for (int repetition = 0; repetition <= repetitions; ++repetition) {
+		auto start = std::chrono::steady_clock::now();
+		glDispatchCompute(compute.workgroups[0], compute.workgroups[1], compute.workgroups[2]);
+		glFinish();
+		if (repetition > 0)
+			best = std::min(best, elapsedMilliseconds(start));
+	}
+	return best;
+}
+
+/// <summary>
+/// Compares raytracing a volume at fixed steps against leaping over the macrocells the transfer function hides,
+/// with a transfer function that hides the lower 30% of the values.
+/// </summary>
+void benchmarkEmptySpaceLeaping(VOLData volume_data, int repetitions = 5) {
+	BenchmarkScene scene;
+	if (!setupBenchmarkScene(volume_data, scene, { { 0, 0.0f }, { 76, 0.0f }, { 77, 0.05f }, { 255, 0.5f } })) {
+		std::cout << "Skipping empty space benchmark of a volume that could not be loaded" << std::endl;
+		return;
+	}
+
+	std::vector<unsigned char> distances = scene.distance_map.distances(glm::ivec3(0), scene.distance_map.cellCount());
+	size_t visible = (size_t)std::count(distances.begin(), distances.end(), 0);
+	std::cout << "----- Empty Space Benchmark: " << volume_data.name << " " << volume_data.resolution.x << "x" << volume_data.resolution.y << "x"
+		<< volume_data.resolution.z << ", " << visible << " of " << distances.size() << " macrocells visible -----" << std::endl;
+	glUniform1i(glGetUniformLocation(compute.program, "u_skipping"), 0);
+	double fixed = timeRaytracing(repetitions);
+	glUniform1i(glGetUniformLocation(compute.program, "u_skipping"), 1);
+	double leaping = timeRaytracing(repetitions);
+	std::cout << "  fixed steps: " << fixed << " ms, leaping: " << leaping << " ms (" << fixed / leaping << "x)" << std::endl;
+
+	clearBenchmarkScene(scene);
+}
+
+/// <summary>
+/// Times every sampling quality with and without pre-integration and measures its error against the finest one without,
+/// as the RMS difference of the images in 8-bit levels. The transfer function has two thin peaks, like the default one,
+/// which point sampling needs small steps not to miss.
+/// </summary>
+void benchmarkSamplingQuality(VOLData volume_data, int repetitions = 3) {
+	BenchmarkScene scene;
+	if (!setupBenchmarkScene(volume_data, scene, { { 75, 0.0f }, { 80, 0.2f }, { 85, 0.0f }, { 125, 0.0f }, { 130, 0.8f }, { 135, 0.0f } })) {
+		std::cout << "Skipping sampling benchmark of a volume that could not be loaded" << std::endl;
+		return;
+	}
+
+	std::cout << "----- Sampling Benchmark: " << volume_data.name << " " << volume_data.resolution.x << "x" << volume_data.resolution.y << "x"
+		<< volume_data.resolution.z << " -----" << std::endl;
+	// point sampled at every quality, then pre-integrated
+	int run_count = 2 * SAMPLING_QUALITY_COUNT;
+	std::vector<std::vector<unsigned char>> images(run_count, std::vector<unsigned char>((size_t)window_width * window_height * 4));
+	std::vector<double> times(run_count);
+	for (int run = 0; run < run_count; ++run) {
+		glUseProgram(compute.program);
+		glUniform1i(glGetUniformLocation(compute.program, "u_preintegrated"), run >= SAMPLING_QUALITY_COUNT);
+		placeSampling(SAMPLING_QUALITIES[run % SAMPLING_QUALITY_COUNT], compute.program);
+		times[run] = timeRaytracing(repetitions);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, raytracing_result);
+		glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, images[run].data());
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	const std::vector<unsigned char>& reference = images[SAMPLING_QUALITY_COUNT - 1];
+	for (int run = 0; run < run_count; ++run) {
+		double squared_error = 0.0;
+		for (size_t i = 0; i < reference.size(); ++i) {
+			double difference = (double)images[run][i] - reference[i];
+			squared_error += difference * difference;
+		}
+		std::cout << "  " << SAMPLING_QUALITIES[run % SAMPLING_QUALITY_COUNT].name << (run >= SAMPLING_QUALITY_COUNT ? " pre-integrated" : "")
+			<< ": " << times[run] << " ms, RMS error " << std::sqrt(squared_error / reference.size()) << std::endl;
+	}
+
+	clearBenchmarkScene(scene);
+}
+
+/// <summary>
+/// Times the general compute program against the variant specialized to the same settings, which has to trace the same image.
+/// </summary>
+void benchmarkShaderVariants(VOLData volume_data, int repetitions = 3) {
+	BenchmarkScene scene;
+	if (!setupBenchmarkScene(volume_data, scene, { { 0, 0.0f }, { 76, 0.0f }, { 77, 0.05f }, { 255, 0.5f } })) {
+		std::cout << "Skipping shader variant benchmark of a volume that could not be loaded" << std::endl;
+		return;
+	}
+
+	std::cout << "----- Shader Variant Benchmark: " << volume_data.name << " " << volume_data.resolution.x << "x" << volume_data.resolution.y << "x"
+		<< volume_data.resolution.z << " -----" << std::endl;
+	std::vector<unsigned char> general_image((size_t)window_width * window_height * 4), variant_image(general_image.size());
+	auto readImage = [](std::vector<unsigned char>& image) {
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, raytracing_result);
+		glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, image.data());
+		glBindTexture(GL_TEXTURE_2D, 0);
+	};
+	for (int samples_per_side : { 1, FULL_SAMPLES_PER_SIDE }) {
+		for (bool preintegrated : { false, true }) {
+			glUseProgram(compute.program);
+			glUniform1i(glGetUniformLocation(compute.program, "u_samples_per_side"), samples_per_side);
+			glUniform1i(glGetUniformLocation(compute.program, "u_preintegrated"), preintegrated);
+			double general = timeRaytracing(repetitions);
+			readImage(general_image);
+
+			// the scene has no gradients to shade with and is not bricked
+			ShaderDefines defines = computeVariantDefines(samples_per_side, false, preintegrated, false);
+			GLuint variant = compute_variants.get(defines);
+			if (variant == 0)
+				continue;
+			compute_variants.copyUniforms(compute.program, variant);
+			double specialized = timeRaytracing(repetitions);
+			readImage(variant_image);
+			int largest_difference = 0;
+			for (size_t i = 0; i < general_image.size(); ++i)
+				largest_difference = std::max(largest_difference, std::abs((int)general_image[i] - variant_image[i]));
+			std::cout << "  " << shaderVariantKey(defines) << ": general " << general << " ms, specialized " << specialized << " ms ("
+				<< general / specialized << "x), largest difference " << largest_difference << std::endl;
+		}
+	}
+	glUseProgram(compute.program);
+
+	clearBenchmarkScene(scene);
+}
 
 int main() {
 	if (!programSetup())
@@ -506,19 +1159,57 @@ int main() {
 	if (DEBUG)
 		hardwareDiagnostic();
 
-	if (!compute.generateProgramFromFile("compute.comp"))
+	if (!compute_variants.load("compute.comp"))
 		return EXIT_FAILURE;
+	// the shape tuned for this device on an earlier run, see the Tune button
+	WorkGroupShape tuned_shape = DEFAULT_WORK_GROUP_SHAPE;
+	if (loadWorkGroupShape(graphicsDeviceName(), tuned_shape))
+		std::cout << "Using the work group shape tuned for this device: " << workGroupShapeName(tuned_shape) << std::endl;
+	if (!compileComputeProgram(tuned_shape) && !compileComputeProgram(DEFAULT_WORK_GROUP_SHAPE))
+		return EXIT_FAILURE;
+	// the jitter of every sample the raytracer takes
+	GLuint sample_sequence_texture = 0, sample_scramble_texture = 0;
+	storeSampleTables(sample_sequence_texture, sample_scramble_texture);
 
 	if (!renderer.generateProgramFromFile("compute.vert", "compute.frag"))
 		return EXIT_FAILURE;
 
 	std::vector<const char*> volume_names = { "LargeBuckyball.vol", "Frog.vol", "Foot.vol", "Skull.vol" };
 
+	if (BENCHMARK) {
+		runLoadingBenchmarks(volume_names);
+		benchmarkVolumeUpload(glm::ivec3(512), VoxelType::UInt8);
+		benchmarkVolumeUpload(glm::ivec3(512), VoxelType::UInt16);
+	}
+
+	// thumbnails come from the pyramid caches, which are built in the background on first use
+	std::vector<std::future<VOLThumbnail>> thumbnail_jobs;
+	std::vector<GLuint> volume_thumbnails(volume_names.size(), 0);
+	for (const char* volume_name : volume_names)
+		thumbnail_jobs.push_back(std::async(std::launch::async, loadVOLThumbnail, std::string(volume_name)));
+
 	if (DEBUG)
 		std::cout << "Reading in volume data" << std::endl;
-	VOLData volume_data = parseVOLDataFromFile(volume_names[volume_id]);
-
-	glGetProgramiv(compute.program, GL_COMPUTE_WORK_GROUP_SIZE, work_group_size.data());
+	// start from the placeholder and let the loader swap in the template volume once it is ready
+	VOLData volume_data;
+	load_template(volume_data);
+	ResampleBudget resample_budget;
+	resample_budget.max_voxels = VOLUME_VOXEL_BUDGET;
+	// volume textures take exactly the bytes of their voxels and gradients, half the budget lets a new volume upload next to the one shown
+	resample_budget.max_bytes = GPU_MEMORY_BUDGET / 2;
+	resample_budget.extra_voxel_bytes = VOL_GRADIENT_BYTES;
+	glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &resample_budget.max_dimension);
+	VolumeLoader volume_loader(HOST_CACHE_BUDGET, resample_budget);
+	volume_loader.request(volume_names[volume_id]);
+	// the other templates are loaded into the host cache in the background, so switching to them is quick
+	volume_loader.prefetch(std::vector<std::string>(volume_names.begin(), volume_names.end()));
+
+	ResidencyLRU<GPUVolume> gpu_cache(GPU_CACHE_BUDGET);
+	gpu_cache.on_evict = [](ResidencyLRU<GPUVolume>::Entry& entry) {
+		gpu_memory.deleteTexture(entry.value.texture, GPUMemoryCategory::Volume);
+		gpu_memory.deleteTexture(entry.value.page_table, GPUMemoryCategory::Volume);
+		gpu_memory.deleteTexture(entry.value.gradients, GPUMemoryCategory::Volume);
+	};
 
 	if (DEBUG) {
 		std::cout << "Local Work Group Size: ";
@@ -526,8 +1217,6 @@ int main() {
 		std::cout << std::endl;
 	}
 
-	compute.workgroups = calculateWorkGroups(work_group_size);
-
 	if (DEBUG) {
 		std::cout << "Compute Work Group Amount: ";
 		std::cout << compute.workgroups[0] << ", " << compute.workgroups[1] << ", " << compute.workgroups[2];
@@ -536,6 +1225,7 @@ int main() {
 
 	render_quad = setupRenderingQuad();
 	raytracing_result = setupRaytracingResultStorage();
+	accumulation_result = setupAccumulationStorage();
 
 	glm::vec3 cam_eye = sphericalToCartesian(camera_spherical),
 		cam_target(0),
@@ -555,11 +1245,38 @@ int main() {
 
 	glUniform2fv(glGetUniformLocation(compute.program, "u_canvas"), 1, glm::value_ptr(canvas));
 
+	if (BENCHMARK) {
+		benchmarkEmptySpaceLeaping(makeSparseSyntheticVolume(glm::ivec3(256)));
+		benchmarkEmptySpaceLeaping(parseVOLDataFromMappedFile(volume_names[0]));
+		benchmarkSamplingQuality(parseVOLDataFromMappedFile(volume_names[0]));
+		benchmarkShaderVariants(parseVOLDataFromMappedFile(volume_names[0]));
+	}
+
 	glm::vec2 xslice(0.0, 1.0), yslice(0.0, 1.0), zslice(0.0, 1.0);
 
 	glm::mat4 volume_inv_matrix;
-	GLuint volume_texture = 0;
-	prepareVolumeData(volume_data, volume_inv_matrix, volume_texture, compute.program);
+	GLuint volume_texture = prepareVolumeData(volume_data, volume_inv_matrix, compute.program);
+	// textures of complete volumes belong to gpu_cache and timesteps to series_textures,
+	// only previews and the placeholder are deleted when replaced
+	bool volume_texture_shared = false;
+	// whether the volume texture is a brick pool, which the compute shader is specialized to
+	bool volume_bricked = false;
+	// the page table when the volume texture is a brick pool
+	GLuint volume_page_table = 0;
+	// the gradients of the volume for shading, 0 if it has none
+	GLuint volume_gradients = 0;
+	bool shading = true;
+	int sampling_quality = DEFAULT_SAMPLING_QUALITY;
+	placeSampling(SAMPLING_QUALITIES[sampling_quality], compute.program);
+
+	TimeSeriesPlayer series_player;
+	VolumeTexturePool series_textures;
+
+	// volumes handed over by the loader stream into a new texture while the current one keeps rendering
+	VolumeUpload volume_upload(&gpu_memory);
+	VOLData uploading_data;
+	VolumeKey uploading_key;
+	std::string gpu_memory_warning;
 
 	std::map<int, glm::vec3> tfunc_color;
 	std::map<int, float> tfunc_opacity;
@@ -615,16 +1332,149 @@ int main() {
 	};
 
 	GLuint tfunc_texture = 0;
-	storeTransferFunction(tfunc_color, tfunc_opacity, tfunc_texture, compute.program);
+	int tfunc_table_size = transferFunctionTableSize(volume_data.voxel_type);
+	std::vector<glm::vec4> tfunc_table = storeTransferFunction(tfunc_color, tfunc_opacity, tfunc_texture, compute.program, tfunc_table_size);
+	// how far the macrocells of the volume are from anything the transfer function shows
+	MacrocellDistanceMap macrocell_distances;
+	GLuint macrocell_texture = 0;
+	storeMacrocellDistances(volume_data, tfunc_table, macrocell_distances, macrocell_texture, compute.program);
+	// the transfer function over whole segments, for compositing long steps
+	PreIntegrationTable preintegration;
+	GLuint preintegrated_texture = 0;
+	bool preintegrated = true;
+	bool progressive = true;
+	bool specialized_shaders = true;
+	// set by the Tune button, the shapes are timed on the next traced frame, with its uniforms and textures
+	bool tune_work_groups = false;
+	storePreIntegratedTransferFunction(tfunc_table, preintegration, preintegrated_texture);
+
+	auto updateTransferFunction = [&]() {
+		tfunc_table = storeTransferFunction(tfunc_color, tfunc_opacity, tfunc_texture, compute.program, tfunc_table_size);
+		storeMacrocellDistances(volume_data, tfunc_table, macrocell_distances, macrocell_texture, compute.program);
+		storePreIntegratedTransferFunction(tfunc_table, preintegration, preintegrated_texture);
+		invalidateImage(true);
+	};
+
+	// swaps in the texture of the volume now in volume_data
+	auto showVolume = [&](const GPUVolume& shown, bool shared) {
+		// whatever is shown supersedes an upload still in flight
+		volume_upload.cancel();
+		if (!volume_texture_shared && shown.texture != volume_texture && glIsTexture(volume_texture)) {
+			gpu_memory.deleteTexture(volume_texture, GPUMemoryCategory::Volume);
+			gpu_memory.deleteTexture(volume_page_table, GPUMemoryCategory::Volume);
+			gpu_memory.deleteTexture(volume_gradients, GPUMemoryCategory::Volume);
+		}
+		volume_texture = shown.texture;
+		volume_page_table = shown.page_table;
+		volume_gradients = shown.gradients;
+		volume_texture_shared = shared;
+		volume_bricked = shown.bricks.bricked;
+		placeBricks(shown.bricks, compute.program);
+		// a closed series keeps its textures until something else is shown
+		if (!series_player.active())
+			clearTexturePool(series_textures);
+
+		if (transferFunctionTableSize(volume_data.voxel_type) != tfunc_table_size) {
+			tfunc_table_size = transferFunctionTableSize(volume_data.voxel_type);
+			tfunc_table = storeTransferFunction(tfunc_color, tfunc_opacity, tfunc_texture, compute.program, tfunc_table_size);
+			storePreIntegratedTransferFunction(tfunc_table, preintegration, preintegrated_texture);
+		}
+		storeMacrocellDistances(volume_data, tfunc_table, macrocell_distances, macrocell_texture, compute.program);
+		invalidateImage();
+	};
 
 	std::string volume_file_path = "File.vol";
+	// seconds to wait after the last keystroke in the file path before loading it
+	const double path_typing_delay = 0.3;
 	glm::vec3 volume_rotations(0);
 
 	glClearColor(0.0, 0.0, 0.0, 1.0);
+	int settle_frames = UI_SETTLE_FRAMES;
 	while (!glfwWindowShouldClose(main_window)) {
 
-		// polling
-		glfwPollEvents();
+		// polling, a static view with nothing in flight blocks on events instead of redrawing at the refresh rate
+		bool thumbnails_pending = std::any_of(thumbnail_jobs.begin(), thumbnail_jobs.end(), [](const auto& job) { return job.valid(); });
+		bool busy = imageOutOfDate(progressive) || quality_governor.interacting(glfwGetTime()) || volume_loader.busy() || volume_upload.active() ||
+			series_player.pending() || thumbnails_pending;
+		if (busy || settle_frames > 0) {
+			glfwPollEvents();
+			settle_frames = busy ? UI_SETTLE_FRAMES : settle_frames - 1;
+		}
+		else {
+			double wait_start = glfwGetTime();
+			glfwWaitEventsTimeout(IDLE_WAIT_SECONDS);
+			// a timeout only looks at background work, an event gets the frames ImGui needs to respond to it
+			if (glfwGetTime() - wait_start < IDLE_WAIT_SECONDS)
+				settle_frames = UI_SETTLE_FRAMES;
+		}
+
+		// the image is traced again whenever the governor changes its quality, including back to the full one once the input stops.
+		// It aims for whole images within the budget of a frame, so the view follows the input
+		double frame_start = glfwGetTime();
+		quality_governor.budget_ms = tile_scheduler.budget_ms;
+		if (quality_governor.update(frame_start, tile_scheduler.passMilliseconds()))
+			invalidateImage();
+
+		VOLData polled_data;
+		VolumeKey polled_key;
+		if (volume_loader.poll(polled_data, &polled_key)) {
+			// previews have no statistics yet and are not worth keeping on the GPU
+			bool complete = polled_data.statistics.computed;
+			ResidencyLRU<GPUVolume>::Entry* resident = complete ? gpu_cache.find(polled_key) : nullptr;
+			if (resident != nullptr) {
+				volume_data = std::move(polled_data);
+				placeVolume(volume_data, volume_inv_matrix, compute.program);
+				volume_data.values.release();
+				volume_data.gradients.release();
+				volume_data.bricks.reset();
+				showVolume(resident->value, true);
+			}
+			else {
+				// make room by evicting cached volumes, a volume that still does not fit is refused
+				size_t texture_bytes = volumeTextureBytes(polled_data);
+				volume_upload.cancel();
+				while (!gpu_memory.fits(texture_bytes) && gpu_cache.evictLeastRecent()) {}
+				if (gpu_memory.fits(texture_bytes)) {
+					gpu_memory_warning.clear();
+					uploading_data = std::move(polled_data);
+					uploading_key = polled_key;
+					volume_upload.begin(uploading_data);
+				}
+				else {
+					gpu_memory_warning = "Not enough GPU memory for " + polled_data.name + ": needs " + std::to_string(texture_bytes >> 20) +
+						" MiB, " + std::to_string((gpu_memory.budgetBytes() - gpu_memory.usedBytes()) >> 20) + " MiB free";
+					std::cerr << "[ERROR] " << gpu_memory_warning << std::endl;
+				}
+			}
+		}
+
+		if (volume_upload.active() && volume_upload.step(UPLOAD_BYTES_PER_FRAME)) {
+			volume_data = std::move(uploading_data);
+			uploading_data = VOLData();
+			if (DEBUG)
+				printVOLData(volume_data);
+			placeVolume(volume_data, volume_inv_matrix, compute.program);
+			size_t texture_bytes = volumeTextureBytes(volume_data);
+			// the texture now holds the voxels, so drop this copy (the host cache keeps its own)
+			volume_data.values.release();
+			volume_data.gradients.release();
+			volume_data.bricks.reset();
+			GPUVolume uploaded = volume_upload.finish();
+			uploaded.header = volume_data;
+			bool complete = volume_data.statistics.computed;
+			if (complete)
+				gpu_cache.insert(uploading_key, uploaded, texture_bytes);
+			showVolume(uploaded, complete);
+		}
+
+		if (series_player.update(volume_data)) {
+			placeVolume(volume_data, volume_inv_matrix, compute.program);
+			GLuint texture = uploadToTexturePool(series_textures, volume_data);
+			volume_data.values.release();
+			GPUVolume series_volume;
+			series_volume.texture = texture;
+			showVolume(series_volume, true);
+		}
 
 		// ImGui rendering
 		ImGui_ImplOpenGL3_NewFrame();
@@ -635,37 +1485,171 @@ int main() {
 
 		ImGui::Text("Insert the absolute file path of the volume data you would like to render.");
 		if (ImGui::InputText("Volume File", &volume_file_path)) {
-			volume_data = parseVOLDataFromFile(volume_file_path.c_str());
-			prepareVolumeData(volume_data, volume_inv_matrix, volume_texture, compute.program);
+			series_player.close();
+			volume_loader.request(volume_file_path, path_typing_delay);
 		}
 
 		if (ImGui::SliderFloat3("Rotation xyz", glm::value_ptr(volume_rotations), -180.0, 180.0)) {
 			generateVolumeMatrix(volume_inv_matrix, volume_rotations, volume_data.true_size);
+			invalidateImage(true);
 		}
 
 
 		ImGui::Text("Select from a list of template volumes.");
-		if (ImGui::Combo("##combo", &volume_id, volume_names.data(), volume_names.size())) {
-			volume_data = parseVOLDataFromFile(volume_names[volume_id]);
-			prepareVolumeData(volume_data, volume_inv_matrix, volume_texture, compute.program);
+		for (size_t i = 0; i < thumbnail_jobs.size(); ++i) {
+			if (thumbnail_jobs[i].valid() && thumbnail_jobs[i].wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+				volume_thumbnails[i] = storeThumbnail(thumbnail_jobs[i].get());
+		}
+
+		if (ImGui::BeginCombo("##combo", volume_names[volume_id])) {
+			for (int i = 0; i < (int)volume_names.size(); ++i) {
+				ImGui::PushID(i);
+				if (volume_thumbnails[i] != 0)
+					ImGui::Image((ImTextureID)(intptr_t)volume_thumbnails[i], ImVec2(32, 32));
+				else
+					ImGui::Dummy(ImVec2(32, 32));
+				ImGui::SameLine();
+				if (ImGui::Selectable(volume_names[i], i == volume_id, 0, ImVec2(0, 32))) {
+					volume_id = i;
+					series_player.close();
+					VolumeKey key;
+					ResidencyLRU<GPUVolume>::Entry* resident = volumeKey(volume_names[volume_id], key) ? gpu_cache.find(key) : nullptr;
+					if (resident != nullptr) {
+						// still on the GPU, swap it in right away
+						volume_loader.cancel();
+						volume_data = resident->value.header;
+						placeVolume(volume_data, volume_inv_matrix, compute.program);
+						showVolume(resident->value, true);
+					}
+					else {
+						volume_loader.request(volume_names[volume_id]);
+					}
+				}
+				ImGui::PopID();
+			}
+			ImGui::EndCombo();
+		}
+
+		if (volume_loader.busy()) {
+			std::string overlay = std::string(loadStageName(volume_loader.currentStage())) + " " + volume_loader.currentStatus();
+			ImGui::ProgressBar(volume_loader.currentProgress(), ImVec2(-1, 0), overlay.c_str());
+		}
+		else if (volume_upload.active()) {
+			ImGui::ProgressBar(volume_upload.progress(), ImVec2(-1, 0), "Uploading");
+		}
+		else if (volume_loader.currentStage() == LoadStage::Failed) {
+			ImGui::TextColored(ImVec4(1.0, 0.4, 0.4, 1.0), "%s", volume_loader.currentStatus().c_str());
+		}
+		std::string resample_summary = volume_loader.resampleSummary();
+		if (!resample_summary.empty())
+			ImGui::Text("Loaded at %s", resample_summary.c_str());
+		ImGui::Text("Cached: host %zu / %zu MiB, GPU %zu / %zu MiB (%zu volumes)",
+			volume_loader.cache.usedBytes() >> 20, volume_loader.cache.budgetBytes() >> 20,
+			gpu_cache.usedBytes() >> 20, gpu_cache.budgetBytes() >> 20, gpu_cache.count());
+		if (ImGui::TreeNode("GPU Memory", "GPU memory: %.1f / %zu MiB", gpu_memory.usedBytes() / 1048576.0, gpu_memory.budgetBytes() >> 20)) {
+			for (int i = 0; i < (int)GPUMemoryCategory::Count; ++i) {
+				GPUMemoryCategory category = (GPUMemoryCategory)i;
+				ImGui::Text("%s: %.1f MiB", gpuMemoryCategoryName(category), gpu_memory.usedBytes(category) / 1048576.0);
+			}
+			ImGui::TreePop();
+		}
+		if (!gpu_memory_warning.empty())
+			ImGui::TextColored(ImVec4(1.0, 0.4, 0.4, 1.0), "%s", gpu_memory_warning.c_str());
+
+		ImGui::Text("Time Series");
+		if (ImGui::Button("Open Series")) {
+			// the numbered series the file in the path box belongs to, e.g. scan_000.vol, scan_001.vol, ...
+			std::vector<std::string> series = discoverVOLSeries(volume_file_path);
+			if (series.empty()) {
+				std::cerr << "[ERROR] No numbered series found for " << volume_file_path << std::endl;
+			}
+			else {
+				volume_loader.cancel();
+				series_player.open(series);
+			}
+		}
+		if (series_player.active()) {
+			ImGui::SameLine();
+			if (ImGui::Button(series_player.isPlaying() ? "Pause" : "Play")) {
+				if (series_player.isPlaying())
+					series_player.pause();
+				else
+					series_player.play();
+			}
+			ImGui::SameLine();
+			if (ImGui::Button("Close Series"))
+				series_player.close();
+
+			int timestep = series_player.currentFrame();
+			if (ImGui::SliderInt("Timestep", &timestep, 0, series_player.frameCount() - 1))
+				series_player.seek(timestep);
+			ImGui::SliderFloat("Frames per Second", &series_player.frames_per_second, 1.0, 60.0, "%.0f");
+			ImGui::Text("Decoded ahead: %d / %d, dropped frames: %llu, prefetch lag: %llu",
+				series_player.ringFill(), series_player.ring_size, series_player.droppedFrames(), series_player.prefetchLag());
+		}
+
+		if (ImGui::Checkbox("Shading", &shading))
+			invalidateImage();
+		if (shading && volume_gradients == 0) {
+			ImGui::SameLine();
+			ImGui::TextDisabled("(no gradients for this volume)");
+		}
+		if (ImGui::BeginCombo("Quality", SAMPLING_QUALITIES[sampling_quality].name)) {
+			for (int i = 0; i < SAMPLING_QUALITY_COUNT; ++i) {
+				if (ImGui::Selectable(SAMPLING_QUALITIES[i].name, i == sampling_quality)) {
+					sampling_quality = i;
+					placeSampling(SAMPLING_QUALITIES[sampling_quality], compute.program);
+					invalidateImage();
+				}
+			}
+			ImGui::EndCombo();
+		}
+		if (ImGui::Checkbox("Pre-integration", &preintegrated))
+			invalidateImage();
+		if (ImGui::Checkbox("Progressive", &progressive))
+			invalidateImage();
+		// the variants trace the same image as the general program, only faster
+		ImGui::Checkbox("Specialized Shaders", &specialized_shaders);
+		if (specialized_shaders) {
+			ImGui::SameLine();
+			ImGui::Text("%zu compiled", compute_variants.compiledCount());
+		}
+		ImGui::Text("Work Groups: %s", workGroupShapeName(work_group_shape).c_str());
+		ImGui::SameLine();
+		if (ImGui::Button("Tune")) {
+			tune_work_groups = true;
+			invalidateImage();
+		}
+		if (progressive) {
+			ImGui::SameLine();
+			ImGui::Text("%u / %u samples", accumulated_samples, PROGRESSIVE_SAMPLES);
+		}
+		ImGui::SliderFloat("Frame Budget (ms)", &tile_scheduler.budget_ms, 2.0, 50.0, "%.0f");
+		if (quality_governor.interacting(frame_start)) {
+			ImGui::SameLine();
+			ImGui::Text("level %d, %.1f ms", quality_governor.currentLevel(), quality_governor.averageFrameMilliseconds());
+		}
+		else if (tile_scheduler.passActive()) {
+			ImGui::SameLine();
+			ImGui::Text("%d / %d tiles", tile_scheduler.tilesDone(), tile_scheduler.tileCount());
 		}
 
 		ImGui::Text("X - Slice");
 
 		if (ImGui::DragFloatRange2("##xslice", &xslice.x, &xslice.y, 0.05, 0.0, 1.0, "%.2f \%")) {
-			// do nothing
+			invalidateImage(true);
 		}
 
 		ImGui::Text("Y - Slice");
 
 		if (ImGui::DragFloatRange2("##yslice", &yslice.x, &yslice.y, 0.05, 0.0, 1.0, "%.2f \%")) {
-			// do nothing
+			invalidateImage(true);
 		}
 
 		ImGui::Text("Z - Slice");
 
 		if (ImGui::DragFloatRange2("##zslice", &zslice.x, &zslice.y, 0.05, 0.0, 1.0, "%.2f \%")) {
-			// do nothing
+			invalidateImage(true);
 		}
 
 
@@ -676,13 +1660,21 @@ int main() {
 			if (i > 0) ImGui::SameLine();
 			ImGui::PushID(i);
 			if (GLMWrapperColorPicker(tfunc_color[i])) {
-				storeTransferFunction(tfunc_color, tfunc_opacity, tfunc_texture, compute.program);
+				updateTransferFunction();
 			}
 			ImGui::PopID();
 		}
 		ImGui::PopID();
 		ImGui::PopStyleVar();
 
+		if (volume_data.statistics.computed) {
+			// log scale so the dominant empty bin does not flatten everything else
+			std::vector<float> log_histogram(256);
+			for (int i = 0; i < 256; ++i)
+				log_histogram[i] = std::log1p((float)volume_data.statistics.histogram[i]);
+			ImGui::PlotHistogram("##histogram", log_histogram.data(), 256, 0, "Value Histogram (log)", 0.0f, FLT_MAX, ImVec2(-1, 60));
+		}
+
 		ImGui::Text("Opacity Sliders");
 		ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, ImVec2(0, 4));
 		ImGui::PushID("opacity_sliders");
@@ -690,7 +1682,7 @@ int main() {
 			if (i > 0) ImGui::SameLine();
 			ImGui::PushID(i);
 			if (ImGui::VSliderFloat("##v", ImVec2(15, 100), &tfunc_opacity[i], 0.0, 1.0, "")) {
-				storeTransferFunction(tfunc_color, tfunc_opacity, tfunc_texture, compute.program);
+				updateTransferFunction();
 			}
 			ImGui::PopID();
 		}
@@ -702,45 +1694,108 @@ int main() {
 		ImGui::Render();
 
 
-		glClear(GL_COLOR_BUFFER_BIT);
+		// compute, an unchanged image or a converged progressive one is presented as it is
+		if (imageOutOfDate(progressive)) {
+			glUseProgram(compute.program);
 
-		// compute
-		glUseProgram(compute.program);
+			glBindImageTexture(0, raytracing_result, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+			glBindImageTexture(1, accumulation_result, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
 
-		glBindImageTexture(0, raytracing_result, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+			cam_eye = sphericalToCartesian(camera_spherical);
+			w = glm::normalize(cam_eye - cam_target);
+			u = glm::normalize(glm::cross(cam_up, w));
+			v = glm::normalize(glm::cross(w, u));
 
-		cam_eye = sphericalToCartesian(camera_spherical);
-		w = glm::normalize(cam_eye - cam_target);
-		u = glm::normalize(glm::cross(cam_up, w));
-		v = glm::normalize(glm::cross(w, u));
+			glUniform3fv(glGetUniformLocation(compute.program, "u_cam_eye"), 1, glm::value_ptr(cam_eye));
+			glUniform3fv(glGetUniformLocation(compute.program, "u_cam_w"), 1, glm::value_ptr(w));
+			glUniform3fv(glGetUniformLocation(compute.program, "u_cam_u"), 1, glm::value_ptr(u));
+			glUniform3fv(glGetUniformLocation(compute.program, "u_cam_v"), 1, glm::value_ptr(v));
 
-		glUniform3fv(glGetUniformLocation(compute.program, "u_cam_eye"), 1, glm::value_ptr(cam_eye));
-		glUniform3fv(glGetUniformLocation(compute.program, "u_cam_w"), 1, glm::value_ptr(w));
-		glUniform3fv(glGetUniformLocation(compute.program, "u_cam_u"), 1, glm::value_ptr(u));
-		glUniform3fv(glGetUniformLocation(compute.program, "u_cam_v"), 1, glm::value_ptr(v));
+			glUniform2fv(glGetUniformLocation(compute.program, "u_xslice"), 1, glm::value_ptr(xslice));
+			glUniform2fv(glGetUniformLocation(compute.program, "u_yslice"), 1, glm::value_ptr(yslice));
+			glUniform2fv(glGetUniformLocation(compute.program, "u_zslice"), 1, glm::value_ptr(zslice));
 
-		glUniform2fv(glGetUniformLocation(compute.program, "u_xslice"), 1, glm::value_ptr(xslice));
-		glUniform2fv(glGetUniformLocation(compute.program, "u_yslice"), 1, glm::value_ptr(yslice));
-		glUniform2fv(glGetUniformLocation(compute.program, "u_zslice"), 1, glm::value_ptr(zslice));
+			glUniform3fv(glGetUniformLocation(compute.program, "u_volume_true_size"), 1, glm::value_ptr(volume_data.true_size));
 
-		glUniform3fv(glGetUniformLocation(compute.program, "u_volume_true_size"), 1, glm::value_ptr(volume_data.true_size));
+			glUniformMatrix4fv(glGetUniformLocation(compute.program, "u_volume_inv_matrix"), 1, GL_FALSE, glm::value_ptr(volume_inv_matrix));
 
-		glUniformMatrix4fv(glGetUniformLocation(compute.program, "u_volume_inv_matrix"), 1, GL_FALSE, glm::value_ptr(volume_inv_matrix));
+			glUniform1i(glGetUniformLocation(compute.program, "u_shading"), shading && volume_gradients != 0);
+			glUniform1i(glGetUniformLocation(compute.program, "u_preintegrated"), preintegrated);
+			glUniform1i(glGetUniformLocation(compute.program, "u_progressive"), progressive);
+			glUniform1i(glGetUniformLocation(compute.program, "u_frame_index"), accumulated_samples);
 
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_3D, volume_texture);
+			// while the view is being changed it is traced at the resolution, samples and step the governor settled on
+			InteractionQuality interaction = quality_governor.quality(frame_start);
+			glm::ivec2 render_size = glm::max(glm::ivec2(glm::vec2(window_width, window_height) * interaction.resolution_scale), glm::ivec2(1));
+			if (!tile_scheduler.passActive())
+				tile_scheduler.beginPass(render_size, work_group_size);
+			glUniform2iv(glGetUniformLocation(compute.program, "u_render_size"), 1, glm::value_ptr(tile_scheduler.passSize()));
+			glUniform1i(glGetUniformLocation(compute.program, "u_samples_per_side"), interaction.samples_per_side);
+			glUniform1f(glGetUniformLocation(compute.program, "u_samples_per_voxel"),
+				SAMPLING_QUALITIES[sampling_quality].samples_per_voxel * interaction.step_scale);
 
-		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_1D, tfunc_texture);
+			glActiveTexture(GL_TEXTURE1);
+			glBindTexture(GL_TEXTURE_3D, volume_texture);
 
-		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+			glActiveTexture(GL_TEXTURE3);
+			glBindTexture(GL_TEXTURE_3D, volume_page_table);
 
-		glDispatchCompute(compute.workgroups[0], compute.workgroups[1], compute.workgroups[2]);
-		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+			glActiveTexture(GL_TEXTURE4);
+			glBindTexture(GL_TEXTURE_3D, volume_gradients);
+
+			glActiveTexture(GL_TEXTURE5);
+			glBindTexture(GL_TEXTURE_3D, macrocell_texture);
+
+			glActiveTexture(GL_TEXTURE6);
+			glBindTexture(GL_TEXTURE_2D, preintegrated_texture);
+
+			glActiveTexture(GL_TEXTURE2);
+			glBindTexture(GL_TEXTURE_1D, tfunc_texture);
+
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+			ShaderDefines trace_defines = computeVariantDefines(interaction.samples_per_side, shading && volume_gradients != 0, preintegrated, volume_bricked);
+			if (tune_work_groups) {
+				tune_work_groups = false;
+				std::string device = graphicsDeviceName();
+				std::cout << "Tuning the work group shape for " << device << std::endl;
+				WorkGroupShape tuned = tuneWorkGroupShape(compute_variants, compute.program, specialized_shaders ? trace_defines : ShaderDefines(),
+					glm::ivec2(window_width, window_height));
+				std::cout << "Tuned work group shape: " << workGroupShapeName(tuned) << std::endl;
+				saveWorkGroupShape(device, tuned);
+				// the tuner left the variants at its last candidate, the pass restarts with the tiles of the new shape
+				if (!compileComputeProgram(tuned))
+					compileComputeProgram(work_group_shape);
+				tile_scheduler.beginPass(render_size, work_group_size);
+			}
+
+			// the settings the variant is specialized to only change between passes, as changing them restarts the pass
+			GLuint trace_program = compute.program;
+			if (specialized_shaders) {
+				GLuint variant = compute_variants.get(trace_defines);
+				if (variant != 0) {
+					compute_variants.copyUniforms(compute.program, variant);
+					trace_program = variant;
+				}
+			}
+			glUseProgram(trace_program);
+
+			// an image that takes longer than the budget is traced over several frames, and presented partially updated in between
+			bool pass_complete = tile_scheduler.dispatch(trace_program);
+			glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+			traced_size = tile_scheduler.passSize();
+			if (pass_complete) {
+				image_dirty = false;
+				if (progressive)
+					++accumulated_samples;
+			}
+		}
 
 		// rendering
 		glClear(GL_COLOR_BUFFER_BIT);
 		glUseProgram(renderer.program);
+		// a reduced image is upscaled to the window
+		glUniform2iv(glGetUniformLocation(renderer.program, "u_render_size"), 1, glm::value_ptr(traced_size));
 
 		glBindVertexArray(render_quad);
 		glActiveTexture(GL_TEXTURE0);
@@ -758,9 +1813,27 @@ int main() {
 
 	}
 
-	glDeleteTextures(1, &raytracing_result);
+	gpu_memory.deleteTexture(raytracing_result, GPUMemoryCategory::Output);
+	gpu_memory.deleteTexture(accumulation_result, GPUMemoryCategory::Output);
+	tile_scheduler.clear();
+	if (!volume_texture_shared && glIsTexture(volume_texture)) {
+		gpu_memory.deleteTexture(volume_texture, GPUMemoryCategory::Volume);
+		gpu_memory.deleteTexture(volume_page_table, GPUMemoryCategory::Volume);
+		gpu_memory.deleteTexture(volume_gradients, GPUMemoryCategory::Volume);
+	}
+	gpu_cache.clear();
+	clearTexturePool(series_textures);
+	volume_upload.clear();
+	gpu_memory.deleteTexture(tfunc_texture, GPUMemoryCategory::TransferFunction);
+	gpu_memory.deleteTexture(macrocell_texture, GPUMemoryCategory::TransferFunction);
+	gpu_memory.deleteTexture(preintegrated_texture, GPUMemoryCategory::TransferFunction);
+	gpu_memory.deleteTexture(sample_sequence_texture, GPUMemoryCategory::TransferFunction);
+	gpu_memory.deleteTexture(sample_scramble_texture, GPUMemoryCategory::TransferFunction);
+	for (GLuint& thumbnail : volume_thumbnails)
+		gpu_memory.deleteTexture(thumbnail, GPUMemoryCategory::Thumbnail);
 	glDeleteProgram(renderer.program);
 	glDeleteProgram(compute.program);
+	compute_variants.clear();
 
 	ImGui_ImplOpenGL3_Shutdown();
 	ImGui_ImplGlfw_Shutdown();